@@ -1,8 +1,11 @@
 // rt_latency.cpp
 // Measures periodic wakeup latency (ns) for a high-priority thread.
 // Compile: g++ -O2 -std=c++17 rt_latency.cpp -o rt_latency -pthread
-// Run: sudo ./rt_latency [period_us] [iterations] [outfile]
-// Example: sudo ./rt_latency 1000 200000 latencies.csv
+// Run: sudo ./rt_latency [period_us] [iterations] [outfile] [clock]
+// Example: sudo ./rt_latency 1000 200000 latencies.csv tai
+// clock (monotonic, monotonic_raw, boottime, tai; default monotonic) is
+// the base of the wake_ns column, the same names as "clock <name>" on
+// /dev/myrtN, so both logs share one timeline.
 
 #include <bits/stdc++.h>
 #include <time.h>
@@ -23,14 +26,30 @@ static inline void ns_to_timespec(long long ns, struct timespec &t) {
     t.tv_nsec = ns % 1000000000LL;
 }
 
+static const struct { const char *name; clockid_t id; } clocks[] = {
+    { "monotonic", CLOCK_MONOTONIC },
+    { "monotonic_raw", CLOCK_MONOTONIC_RAW },
+    { "boottime", CLOCK_BOOTTIME },
+    { "tai", CLOCK_TAI },
+};
+
 int main(int argc, char** argv) {
     if (argc < 4) {
-        fprintf(stderr, "Usage: %s <period_us> <iterations> <out.csv>\n", argv[0]);
+        fprintf(stderr, "Usage: %s <period_us> <iterations> <out.csv> [monotonic|monotonic_raw|boottime|tai]\n", argv[0]);
         return 1;
     }
     const long period_us = atol(argv[1]);
     const int iterations = atoi(argv[2]);
     const char* outfn = argv[3];
+    const char* clock_name = argc > 4 ? argv[4] : "monotonic";
+    clockid_t wake_clock = -1;
+    for (auto &c: clocks)
+        if (!strcmp(c.name, clock_name))
+            wake_clock = c.id;
+    if (wake_clock == -1) {
+        fprintf(stderr, "unknown clock %s\n", clock_name);
+        return 1;
+    }
 
     // Lock memory to avoid page faults
     if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
@@ -59,8 +78,9 @@ int main(int argc, char** argv) {
     }
 
     // Pre-touch memory vector to avoid page faults later
-    vector<long long> lat_ns;
+    vector<long long> lat_ns, wake_ns;
     lat_ns.reserve(iterations);
+    wake_ns.reserve(iterations);
 
     struct timespec t;
     clock_gettime(CLOCK_MONOTONIC, &t);
@@ -78,22 +98,24 @@ int main(int argc, char** argv) {
             r = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
         } while (r == EINTR);
 
-        struct timespec now;
+        struct timespec now, wake;
         clock_gettime(CLOCK_MONOTONIC, &now);
+        clock_gettime(wake_clock, &wake);
         long long now_ns = timespec_to_ns(now);
 
         long long latency = now_ns - next_ns; // positive if woke late, negative if early
         lat_ns.push_back(latency);
+        wake_ns.push_back(timespec_to_ns(wake));
 
         next_ns += period_ns;
     }
 
-    // Write CSV (header + latencies in ns)
+    // Write CSV (header + latencies in ns, wake time on the chosen clock)
     FILE* f = fopen(outfn, "w");
     if (!f) { perror("fopen"); return 1; }
-    fprintf(f, "index,latency_ns\n");
+    fprintf(f, "index,latency_ns,wake_ns\n");
     for (size_t i = 0; i < lat_ns.size(); ++i) {
-        fprintf(f, "%zu,%lld\n", i, lat_ns[i]);
+        fprintf(f, "%zu,%lld,%lld\n", i, lat_ns[i], wake_ns[i]);
     }
     fclose(f);
 
@@ -110,7 +132,7 @@ int main(int argc, char** argv) {
     var /= lat_ns.size();
     double sd = sqrt(var);
 
-    printf("period_us=%ld iterations=%d\n", period_us, iterations);
+    printf("period_us=%ld iterations=%d clock=%s\n", period_us, iterations, clock_name);
     printf("min=%lld ns  max=%lld ns  mean=%.2f ns  sd=%.2f ns\n",
            minv, maxv, mean, sd);
     printf("Wrote %zu samples to %s\n", lat_ns.size(), outfn);
@@ -0,0 +1,2 @@
+#!/bin/bash
+g++ -O2 -std=c++17 loopback.cpp -o loopback -pthread
@@ -0,0 +1,47 @@
+#!/bin/bash
+# Stream capture edges through myrt's IIO buffer on gpio-sim: the loopback
+# relay feeds PWM line 0 into capture line 1 while iio_readdev (libiio
+# utils) reads the scans. Prints count, period and timestamp spacing.
+# Usage: sudo ./iio_capture.sh [samples] [period_us]
+N=${1:-2000}
+PERIOD=${2:-1000}
+KO=../motor_control_drive/myrt.ko
+DEV=/dev/myrt0
+SECS=$(( N * PERIOD / 1000000 + 2 ))
+
+modprobe gpio-sim || exit 1
+modprobe industrialio-kfifo-buf 2>/dev/null
+SIM=$(./sim_setup.sh) || exit 1
+rmmod myrt 2>/dev/null
+insmod $KO gpio_chip=myrt-sim pwm_gpios=0 meas_gpio=1 || exit 1
+# as in run.sh: no instance when probe turned the lines down
+if [ ! -e $DEV ]; then
+    dmesg | grep myrt | tail -n 3
+    rmmod myrt
+    ./sim_teardown.sh
+    exit 1
+fi
+echo "period $PERIOD" > $DEV || exit 1
+echo 50 > $DEV
+
+mkdir -p results
+./loopback $SIM 0 1 $PERIOD 50 $SECS results/iio_relay.csv > /dev/null &
+relay=$!
+# scan: u32 channel, 4 bytes padding, u64 period ns, s64 timestamp ns
+iio_readdev -b 256 -s $N myrt > results/iio.bin
+wait $relay
+
+python3 - results/iio.bin <<'PY'
+import struct, sys, statistics
+data = open(sys.argv[1], 'rb').read()
+recs = [struct.unpack_from('<IxxxxQq', data, o) for o in range(0, len(data) - 23, 24)]
+print("samples", len(recs))
+if len(recs) > 2:
+    per = [r[1] / 1000 for r in recs[1:]]
+    dts = [(b[2] - a[2]) / 1000 for a, b in zip(recs, recs[1:])]
+    print("period_us   mean %.1f sd %.1f" % (statistics.mean(per), statistics.pstdev(per)))
+    print("ts delta us mean %.1f sd %.1f" % (statistics.mean(dts), statistics.pstdev(dts)))
+PY
+
+rmmod myrt
+./sim_teardown.sh
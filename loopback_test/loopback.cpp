@@ -0,0 +1,178 @@
+// loopback.cpp
+// Relays a gpio-sim output line (myrt PWM) to a gpio-sim input line (myrt
+// capture) and measures the relayed signal: period, duty and how late each
+// rising edge is against the ideal period grid.
+// Compile: g++ -O2 -std=c++17 loopback.cpp -o loopback -pthread
+// Run: sudo ./loopback <sim_chip_dir> <pwm_line> <meas_line> <period_us> <duty> <seconds> <out.csv>
+// Example: sudo ./loopback /sys/devices/platform/gpio-sim.0/gpiochip3 0 1 1000 50 5 lb.csv
+// Exit status 1 if the mean period or duty is off by more than the tolerance.
+
+#include <bits/stdc++.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+using namespace std;
+
+static inline long long now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static int open_attr(const string &dir, int line, const char *attr, int flags) {
+    string fn = dir + "/sim_gpio" + to_string(line) + "/" + attr;
+    int fd = open(fn.c_str(), flags);
+    if (fd < 0) {
+        perror(fn.c_str());
+        exit(2);
+    }
+    return fd;
+}
+
+// sim_gpioN/value holds "0\n" or "1\n"
+static int read_level(int fd) {
+    char c;
+    if (pread(fd, &c, 1, 0) != 1) {
+        perror("pread");
+        exit(2);
+    }
+    return c == '1';
+}
+
+// gpio-sim raises the line IRQ when the pull changes
+static void write_pull(int fd, int level) {
+    static const char up[] = "pull-up", down[] = "pull-down";
+    ssize_t r = level ? pwrite(fd, up, sizeof(up) - 1, 0)
+                      : pwrite(fd, down, sizeof(down) - 1, 0);
+    if (r < 0) {
+        perror("pwrite");
+        exit(2);
+    }
+}
+
+struct stats {
+    double mean = 0, sd = 0, p99 = 0;
+    long long minv = 0, maxv = 0;
+};
+
+static stats summarize(vector<long long> v) {
+    stats s;
+    if (v.empty()) return s;
+    sort(v.begin(), v.end());
+    double sum = 0;
+    for (auto x : v) sum += x;
+    s.mean = sum / v.size();
+    double var = 0;
+    for (auto x : v) var += (x - s.mean) * (x - s.mean);
+    s.sd = sqrt(var / v.size());
+    s.minv = v.front();
+    s.maxv = v.back();
+    s.p99 = v[min(v.size() - 1, (size_t)(v.size() * 0.99))];
+    return s;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 8) {
+        fprintf(stderr, "Usage: %s <sim_chip_dir> <pwm_line> <meas_line> <period_us> <duty> <seconds> <out.csv> [cpu]\n", argv[0]);
+        return 2;
+    }
+    const string dir = argv[1];
+    const int pwm_line = atoi(argv[2]);
+    const int meas_line = atoi(argv[3]);
+    const long long period_ns = atoll(argv[4]) * 1000LL;
+    const int duty = atoi(argv[5]);
+    const double seconds = atof(argv[6]);
+    const char* outfn = argv[7];
+    const int cpu = argc > 8 ? atoi(argv[8]) : 1;
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        perror("mlockall");
+
+    // keep the relay off the CPU the myrt hrtimers run on
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    if (sched_setaffinity(0, sizeof(cpuset), &cpuset) != 0)
+        perror("sched_setaffinity");
+
+    struct sched_param sp;
+    sp.sched_priority = 80;
+    if (sched_setscheduler(0, SCHED_FIFO, &sp) != 0) {
+        perror("sched_setscheduler");
+        fprintf(stderr, "Warning: couldn't set SCHED_FIFO, the relay adds its own jitter.\n");
+    }
+
+    int in_fd = open_attr(dir, pwm_line, "value", O_RDONLY);
+    int out_fd = open_attr(dir, meas_line, "pull", O_WRONLY);
+
+    // transitions: time, new level
+    vector<pair<long long, int>> tr;
+    tr.reserve((size_t)(seconds * 2e9 / period_ns) + 16);
+    long long polls = 0;
+
+    int level = read_level(in_fd);
+    write_pull(out_fd, level);
+    const long long end = now_ns() + (long long)(seconds * 1e9);
+    long long t;
+    while ((t = now_ns()) < end) {
+        int l = read_level(in_fd);
+        polls++;
+        if (l == level) continue;
+        write_pull(out_fd, l);
+        tr.emplace_back(t, l);
+        level = l;
+    }
+    write_pull(out_fd, 0);
+
+    FILE* f = fopen(outfn, "w");
+    if (!f) { perror("fopen"); return 2; }
+    fprintf(f, "index,t_ns,level\n");
+    for (size_t i = 0; i < tr.size(); ++i)
+        fprintf(f, "%zu,%lld,%d\n", i, tr[i].first, tr[i].second);
+    fclose(f);
+
+    // period and duty from consecutive rising edges, lateness against the
+    // grid anchored at the earliest-relative edge
+    vector<long long> rise, periods, duties_ppm, late;
+    long long last_rise = -1;
+    for (auto &e : tr) {
+        if (e.second) {
+            if (last_rise >= 0) periods.push_back(e.first - last_rise);
+            rise.push_back(e.first);
+            last_rise = e.first;
+        } else if (last_rise >= 0) {
+            duties_ppm.push_back((e.first - last_rise) * 1000000LL / period_ns);
+        }
+    }
+    if (rise.size() < 2) {
+        fprintf(stderr, "only %zu rising edges seen\n", rise.size());
+        return 1;
+    }
+    long long best = LLONG_MAX;
+    for (auto r : rise) {
+        long long k = llround((double)(r - rise[0]) / period_ns);
+        late.push_back(r - rise[0] - k * period_ns);
+        best = min(best, late.back());
+    }
+    for (auto &l : late) l -= best;
+
+    stats ps = summarize(periods), ds = summarize(duties_ppm), ls = summarize(late);
+    double poll_ns = seconds * 1e9 / max(polls, 1LL);
+    printf("period_us=%lld duty=%d%% seconds=%.1f polls=%lld (%.0f ns each)\n",
+           period_ns / 1000, duty, seconds, polls, poll_ns);
+    printf("edges=%zu expected=%.0f\n", rise.size(), seconds * 1e9 / period_ns);
+    printf("period: mean=%.0f ns sd=%.0f min=%lld max=%lld\n", ps.mean, ps.sd, ps.minv, ps.maxv);
+    printf("duty:   mean=%.2f%% sd=%.2f%%\n", ds.mean / 1e4, ds.sd / 1e4);
+    printf("late:   mean=%.0f ns p99=%.0f max=%lld\n", ls.mean, ls.p99, ls.maxv);
+
+    // the relay samples the line, so its resolution is a few polls
+    double tol_ns = max(3 * poll_ns, 0.005 * period_ns);
+    bool ok = fabs(ps.mean - period_ns) <= tol_ns &&
+              fabs(ds.mean / 1e4 - duty) <= 100.0 * tol_ns / period_ns + 1.0;
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
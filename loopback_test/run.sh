@@ -0,0 +1,48 @@
+#!/bin/bash
+# Load myrt on gpio-sim with PWM line 0 relayed to capture line 1, sweep
+# period and duty, and check the relayed signal and the period myrt captured.
+# Usage: sudo ./run.sh [seconds per point]
+SECS=${1:-3}
+KO=../motor_control_drive/myrt.ko
+DEV=/dev/myrt0
+SYS=/sys/class/myrtclass/myrt0
+
+modprobe gpio-sim || exit 1
+SIM=$(./sim_setup.sh) || exit 1
+rmmod myrt 2>/dev/null
+insmod $KO gpio_chip=myrt-sim pwm_gpios=0 meas_gpio=1 || exit 1
+# PWM lines that can sleep (gpio-sim's) are written from myrt's output
+# kthread; probe still fails if the chip's lines cannot be used at all
+if [ ! -e $DEV ]; then
+    dmesg | grep myrt | tail -n 3
+    rmmod myrt
+    exit 1
+fi
+
+fail=0
+mkdir -p results
+for period in 1000 2000 5000; do
+    echo "period $period" > $DEV
+    for duty in 10 25 50 75 90; do
+        echo $duty > $DEV
+        sleep 0.1
+        edges0=$(cat $SYS/capture_edges)
+        out=results/lb_${period}us_${duty}.csv
+        ./loopback $SIM 0 1 $period $duty $SECS $out > results/lb_${period}us_${duty}.txt
+        res=$?
+        edges1=$(cat $SYS/capture_edges)
+        captured=$(cut -d" " -f1 $SYS/period_us)
+        # the captured period, in us, must match what was set
+        if [ $res -ne 0 ] || [ $(( captured > period ? captured - period : period - captured )) -gt $(( period / 100 + 5 )) ]; then
+            res=1
+            fail=1
+        fi
+        printf "%6s us %3s%%  captured %6s us  edges %6s  %s\n" $period $duty "$captured" \
+            $(( edges1 - edges0 )) "$([ $res -eq 0 ] && echo PASS || echo FAIL)"
+        grep "late:" results/lb_${period}us_${duty}.txt
+    done
+done
+
+rmmod myrt
+./sim_teardown.sh
+exit $fail
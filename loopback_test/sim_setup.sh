@@ -0,0 +1,15 @@
+#!/bin/bash
+# Create a gpio-sim chip labelled myrt-sim with 16 lines and print the
+# sysfs dir holding its sim_gpioN attributes.
+# Needs CONFIG_GPIO_SIM and configfs: sudo modprobe gpio-sim
+set -e
+CFG=/sys/kernel/config/gpio-sim/myrt-sim
+
+if [ ! -d $CFG ]; then
+    mkdir $CFG
+    mkdir $CFG/bank0
+    echo 16 > $CFG/bank0/num_lines
+    echo myrt-sim > $CFG/bank0/label
+    echo 1 > $CFG/live
+fi
+echo /sys/devices/platform/$(cat $CFG/dev_name)/$(cat $CFG/bank0/chip_name)
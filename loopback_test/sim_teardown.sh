@@ -0,0 +1,6 @@
+#!/bin/bash
+CFG=/sys/kernel/config/gpio-sim/myrt-sim
+[ -d $CFG ] || exit 0
+echo 0 > $CFG/live
+rmdir $CFG/bank0
+rmdir $CFG
@@ -0,0 +1,149 @@
+// myrt.h
+// Glue between myrt_main.c and the optional kernel-facing frontends that
+// sit on top of the core.
+#ifndef MYRT_H
+#define MYRT_H
+
+#include <linux/device.h>
+#include "myrt_core.h"
+
+struct myrt_pwm;
+
+// PWM channels as a pwm_chip under /sys/class/pwm
+#if IS_ENABLED(CONFIG_PWM)
+struct myrt_pwm *myrt_pwm_register(struct device *parent, struct myrt_core *core);
+void myrt_pwm_unregister(struct myrt_pwm *mp);
+#else
+static inline struct myrt_pwm *myrt_pwm_register(struct device *parent,
+                                                 struct myrt_core *core)
+{
+    return NULL;
+}
+static inline void myrt_pwm_unregister(struct myrt_pwm *mp) { }
+#endif
+
+struct myrt_counter;
+
+// capture channels under /sys/bus/counter, edge events on the counter chrdev
+#if IS_ENABLED(CONFIG_COUNTER)
+struct myrt_counter *myrt_counter_register(struct device *parent, struct myrt_core *core);
+void myrt_counter_unregister(struct myrt_counter *mc);
+void myrt_counter_push(struct myrt_counter *mc, unsigned int ch);
+#else
+static inline struct myrt_counter *myrt_counter_register(struct device *parent,
+                                                         struct myrt_core *core)
+{
+    return NULL;
+}
+static inline void myrt_counter_unregister(struct myrt_counter *mc) { }
+static inline void myrt_counter_push(struct myrt_counter *mc, unsigned int ch) { }
+#endif
+
+struct myrt_iio;
+
+// capture edges as IIO buffer scans
+#if IS_ENABLED(CONFIG_IIO_KFIFO_BUF)
+struct myrt_iio *myrt_iio_register(struct device *parent, struct myrt_core *core);
+void myrt_iio_unregister(struct myrt_iio *mi);
+void myrt_iio_push(struct myrt_iio *mi, struct capture_chan *cap, ktime_t edge);
+#else
+static inline struct myrt_iio *myrt_iio_register(struct device *parent,
+                                                 struct myrt_core *core)
+{
+    return NULL;
+}
+static inline void myrt_iio_unregister(struct myrt_iio *mi) { }
+static inline void myrt_iio_push(struct myrt_iio *mi, struct capture_chan *cap,
+                                 ktime_t edge) { }
+#endif
+
+struct myrt_hte;
+
+// hardware timestamps of a capture channel, NULL = none, software timestamps
+#if IS_ENABLED(CONFIG_HTE)
+struct myrt_hte *myrt_hte_request(struct device *dev, struct capture_chan *cap,
+                                  struct gpio_desc *gpio);
+void myrt_hte_release(struct myrt_hte *mh);
+#else
+static inline struct myrt_hte *myrt_hte_request(struct device *dev,
+                                                struct capture_chan *cap,
+                                                struct gpio_desc *gpio)
+{
+    return NULL;
+}
+static inline void myrt_hte_release(struct myrt_hte *mh) { }
+#endif
+
+// alarms and decimated edges on the "myrt" generic netlink family
+struct myrt_genl_alarm {
+    u32 type;                   // enum myrt_alarm
+    u32 ch;
+    u64 value;
+};
+
+struct myrt_genl_sample {
+    u64 seq;
+    u64 period_ns;
+    s64 ts_ns;
+    u32 ch;
+};
+
+#if IS_ENABLED(CONFIG_NET)
+int myrt_genl_register(void);
+void myrt_genl_unregister(void);
+bool myrt_genl_alarms_wanted(void);
+bool myrt_genl_samples_wanted(void);
+int myrt_genl_send_alarms(int dev_id, const struct myrt_genl_alarm *a,
+                          unsigned int n);
+int myrt_genl_send_samples(int dev_id, const struct myrt_genl_sample *s,
+                           unsigned int n, u64 dropped);
+#else
+static inline int myrt_genl_register(void) { return 0; }
+static inline void myrt_genl_unregister(void) { }
+static inline bool myrt_genl_alarms_wanted(void) { return false; }
+static inline bool myrt_genl_samples_wanted(void) { return false; }
+static inline int myrt_genl_send_alarms(int dev_id, const struct myrt_genl_alarm *a,
+                                        unsigned int n)
+{
+    return 0;
+}
+static inline int myrt_genl_send_samples(int dev_id, const struct myrt_genl_sample *s,
+                                         unsigned int n, u64 dropped)
+{
+    return n;
+}
+#endif
+
+// Control law, a BPF struct_ops program run on every edge of one capture
+// channel ("ctl" command): the measured period in, the next duty of one
+// PWM channel out. Read only for the program.
+struct myrt_ctl_state {
+    u32 dev;                    // N of /dev/myrtN
+    u32 in_ch;                  // capture channel of the edge
+    u32 out_ch;                 // PWM channel the result goes to
+    s32 duty;                   // its commanded duty now, percent
+    u64 seq;                    // accepted edges of in_ch, this one included
+    u64 period_ns;              // this edge minus the one before, 0 = first
+    s64 ts_ns;                  // the edge, CLOCK_MONOTONIC
+    u64 setpoint;               // as given to "ctl", meaning is up to the law
+    u32 pwm_period_ns;
+};
+
+struct myrt_ctl_ops {
+    // next duty of out_ch in percent, negative = leave it as it is
+    int (*step)(struct myrt_ctl_state *st);
+    char name[16];
+};
+
+#if IS_ENABLED(CONFIG_BPF_JIT) && IS_ENABLED(CONFIG_BPF_SYSCALL) && \
+    IS_ENABLED(CONFIG_DEBUG_INFO_BTF_MODULES)
+int myrt_bpf_register(void);
+int myrt_bpf_step(struct myrt_ctl_state *st);
+int myrt_bpf_law_name(char *name, size_t len);
+#else
+static inline int myrt_bpf_register(void) { return 0; }
+static inline int myrt_bpf_step(struct myrt_ctl_state *st) { return -EOPNOTSUPP; }
+static inline int myrt_bpf_law_name(char *name, size_t len) { return -EOPNOTSUPP; }
+#endif
+
+#endif
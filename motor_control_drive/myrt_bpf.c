@@ -0,0 +1,157 @@
+// myrt_bpf.c
+// struct_ops "myrt_ctl_ops": a control law loaded as a BPF program, called
+// by myrt_main.c for every edge of the capture channel picked with "ctl".
+// One law is registered at a time and serves every instance, st->dev tells
+// them apart. The verifier keeps it from doing anything but reading the
+// state and using maps; JITed, a call costs about as much as a direct one.
+// Example law: user/myrt_ctl_pi.bpf.c.
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bpf.h>
+#include <linux/btf.h>
+#include <linux/bpf_verifier.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+
+#include "myrt.h"
+
+static struct myrt_ctl_ops __rcu *myrt_ctl_law;
+static DEFINE_MUTEX(myrt_ctl_mutex);     // writers of myrt_ctl_law
+
+// From the capture path (hard IRQ, irq_work or the capture kthread). The
+// law's trampoline adds its own RCU read section and migrate_disable().
+int myrt_bpf_step(struct myrt_ctl_state *st)
+{
+    struct myrt_ctl_ops *law;
+    int ret = -ENOENT;
+
+    rcu_read_lock();
+    law = rcu_dereference(myrt_ctl_law);
+    if (law)
+        ret = law->step(st);
+    rcu_read_unlock();
+    return ret;
+}
+
+int myrt_bpf_law_name(char *name, size_t len)
+{
+    struct myrt_ctl_ops *law;
+    int ret = -ENOENT;
+
+    rcu_read_lock();
+    law = rcu_dereference(myrt_ctl_law);
+    if (law) {
+        strscpy(name, law->name, len);
+        ret = 0;
+    }
+    rcu_read_unlock();
+    return ret;
+}
+
+// ====== struct_ops ======
+static int myrt_ctl_init(struct btf *btf)
+{
+    return 0;
+}
+
+static bool myrt_ctl_is_valid_access(int off, int size, enum bpf_access_type type,
+                                     const struct bpf_prog *prog,
+                                     struct bpf_insn_access_aux *info)
+{
+    return bpf_tracing_btf_ctx_access(off, size, type, prog, info);
+}
+
+// no btf_struct_access: the verifier rejects any store through st
+static const struct bpf_verifier_ops myrt_ctl_verifier_ops = {
+    .get_func_proto  = bpf_base_func_proto,
+    .is_valid_access = myrt_ctl_is_valid_access,
+};
+
+// the only data member is the name, copied from the map value
+static int myrt_ctl_init_member(const struct btf_type *t,
+                                const struct btf_member *member,
+                                void *kdata, const void *udata)
+{
+    const struct myrt_ctl_ops *uops = udata;
+    struct myrt_ctl_ops *ops = kdata;
+
+    if (member->offset != offsetof(struct myrt_ctl_ops, name) * 8)
+        return 0;
+    if (strscpy(ops->name, uops->name, sizeof(ops->name)) <= 0)
+        return -EINVAL;
+    return 1;
+}
+
+static int myrt_ctl_validate(void *kdata)
+{
+    return ((struct myrt_ctl_ops *)kdata)->step ? 0 : -EINVAL;
+}
+
+static int myrt_ctl_reg(void *kdata, struct bpf_link *link)
+{
+    int ret = 0;
+
+    mutex_lock(&myrt_ctl_mutex);
+    if (rcu_access_pointer(myrt_ctl_law))
+        ret = -EBUSY;
+    else
+        rcu_assign_pointer(myrt_ctl_law, kdata);
+    mutex_unlock(&myrt_ctl_mutex);
+    return ret;
+}
+
+static void myrt_ctl_unreg(void *kdata, struct bpf_link *link)
+{
+    mutex_lock(&myrt_ctl_mutex);
+    if (rcu_access_pointer(myrt_ctl_law) == kdata)
+        RCU_INIT_POINTER(myrt_ctl_law, NULL);
+    mutex_unlock(&myrt_ctl_mutex);
+    // an edge on another CPU may still be in step()
+    synchronize_rcu();
+}
+
+// bpf_link_update(): the new law takes over from the next edge, no gap
+static int myrt_ctl_update(void *kdata, void *old_kdata, struct bpf_link *link)
+{
+    int ret = 0;
+
+    mutex_lock(&myrt_ctl_mutex);
+    if (rcu_access_pointer(myrt_ctl_law) != old_kdata)
+        ret = -ENOENT;
+    else
+        rcu_assign_pointer(myrt_ctl_law, kdata);
+    mutex_unlock(&myrt_ctl_mutex);
+    if (!ret)
+        synchronize_rcu();
+    return ret;
+}
+
+// CFI stubs: the signatures the trampolines are built for, never called
+static int myrt_ctl_step_stub(struct myrt_ctl_state *st)
+{
+    return -1;
+}
+
+static struct myrt_ctl_ops __myrt_ctl_ops = {
+    .step = myrt_ctl_step_stub,
+};
+
+static struct bpf_struct_ops bpf_myrt_ctl_ops = {
+    .verifier_ops   = &myrt_ctl_verifier_ops,
+    .init           = myrt_ctl_init,
+    .init_member    = myrt_ctl_init_member,
+    .validate       = myrt_ctl_validate,
+    .reg            = myrt_ctl_reg,
+    .unreg          = myrt_ctl_unreg,
+    .update         = myrt_ctl_update,
+    .cfi_stubs      = &__myrt_ctl_ops,
+    .name           = "myrt_ctl_ops",
+    .owner          = THIS_MODULE,
+};
+
+// From module init. Goes away with the module's BTF, there is no unregister.
+int myrt_bpf_register(void)
+{
+    return register_bpf_struct_ops(&bpf_myrt_ctl_ops, myrt_ctl_ops);
+}
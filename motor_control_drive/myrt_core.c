@@ -0,0 +1,868 @@
+// myrt_core.c
+// PWM engine, PLL and capture path of myrt, see myrt_core.h.
+
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/bitops.h>
+#include <linux/string.h>
+
+#include "myrt_core.h"
+
+// ====== Phase lock to the capture input or a clock ======
+// A PI loop on the phase between each MEAS_IN edge and the start of the PWM
+// period. The correction stretches or shortens the last step of the next
+// period, limited to half a step so the step stays positive. The P part is
+// used up once applied; the I part carries the frequency offset and is
+// applied every period.
+#define PLL_MAX_CORR_NS(period)  ((period) / 200)    // half a step
+#define PLL_LOCK_COUNT   16     // edges in the window before reporting lock
+// clock reference: a phase error this large is jumped, not pulled in
+#define PLL_JUMP_NS(period)      (8 * PLL_MAX_CORR_NS(period))
+
+// Fold a phase error into (-T/2, T/2]: the closest period start is the one
+// to track.
+s32 pll_phase_fold(s64 err, s32 period)
+{
+    s32 rem;
+
+    div_s64_rem(err, period, &rem);
+    if (rem > period / 2)
+        rem -= period;
+    else if (rem <= -period / 2)
+        rem += period;
+    return rem;
+}
+
+static void pll_update(struct myrt_core *core, ktime_t edge)
+{
+    struct myrt_pll *pll = &core->pll;
+    s32 period = READ_ONCE(core->period_ns);
+    s64 integ_max = (s64)PLL_MAX_CORR_NS(period) << pll->ki_shift;
+    s32 rem = pll_phase_fold(ktime_to_ns(ktime_sub(edge, READ_ONCE(core->period_start))),
+                             period);
+
+    if (abs(rem) <= pll->lock_ns) {
+        if (pll->in_window < PLL_LOCK_COUNT)
+            pll->in_window++;
+    } else {
+        pll->in_window = 0;
+    }
+    WRITE_ONCE(pll->locked, pll->in_window >= PLL_LOCK_COUNT);
+    WRITE_ONCE(pll->phase_err_ns, rem);
+    if (abs(rem) > pll->phase_err_max_ns)
+        WRITE_ONCE(pll->phase_err_max_ns, abs(rem));
+
+    // edge after our period start: we run early, so stretch the period
+    pll->integ_ns = clamp(pll->integ_ns + rem, -integ_max, integ_max);
+    WRITE_ONCE(pll->p_corr_ns, (s64)rem >> pll->kp_shift);
+    WRITE_ONCE(pll->i_corr_ns, pll->integ_ns >> pll->ki_shift);
+    WRITE_ONCE(pll->last_edge, edge);
+}
+
+// Clock reference, from pwm_timer_callback at counter 0. The "edge" is the
+// multiple of the period (plus ref_phase_ns) on the reference clock that is
+// closest to the period start just begun, taken back to CLOCK_MONOTONIC;
+// from there on it is the same loop as for a capture edge. The clock is read
+// at every period start, so a step of it shows up as a phase error at once.
+static void pll_clock_update(struct myrt_core *core)
+{
+    struct myrt_pll *pll = &core->pll;
+    s32 period = core->period_ns;
+    ktime_t start = core->period_start;
+    s64 ref = ktime_to_ns(core->pll_ref_clock(core, start)) - pll->ref_phase_ns;
+    s32 rem = pll_phase_fold(ref, period);      // > 0: we start late
+
+    if (!pll->jump && abs(rem) <= PLL_JUMP_NS(period)) {
+        pll_update(core, ktime_sub(start, ns_to_ktime(rem)));
+        return;
+    }
+    // far off (just enabled, clock stepped, new period): stretch the last
+    // step of this period up to the next multiple, and restart the loop
+    pll->jump = false;
+    WRITE_ONCE(pll->jumps, pll->jumps + 1);
+    pll->in_window = 0;
+    pll->integ_ns = 0;
+    WRITE_ONCE(pll->locked, false);
+    WRITE_ONCE(pll->phase_err_ns, -rem);
+    WRITE_ONCE(pll->i_corr_ns, 0);
+    WRITE_ONCE(pll->p_corr_ns, 0);
+    pll->jump_ns = rem > 0 ? period - rem : -rem;
+    WRITE_ONCE(pll->last_edge, start);
+}
+
+// Correction for the last step of the period, called from pwm_timer_callback
+static s64 pll_take_correction(struct myrt_pll *pll, s64 period, ktime_t now)
+{
+    s64 corr = READ_ONCE(pll->p_corr_ns) + READ_ONCE(pll->i_corr_ns);
+
+    WRITE_ONCE(pll->p_corr_ns, 0);
+    // a jump goes in whole, it only ever lengthens the period
+    if (pll->jump_ns) {
+        corr = pll->jump_ns;
+        pll->jump_ns = 0;
+        return corr;
+    }
+    // no reference edge for two periods: hold frequency, drop lock
+    if (ktime_to_ns(ktime_sub(now, READ_ONCE(pll->last_edge))) > 2 * period) {
+        pll->in_window = 0;
+        WRITE_ONCE(pll->locked, false);
+    }
+    return clamp_t(s64, corr, -PLL_MAX_CORR_NS(period), PLL_MAX_CORR_NS(period));
+}
+
+// The next edge starts from a clean state. Off while the reference is
+// switched, so neither update path sees half of it.
+static void pll_start(struct myrt_core *core, int ref, s64 phase_ns, bool on)
+{
+    struct myrt_pll *pll = &core->pll;
+
+    WRITE_ONCE(pll->enabled, false);
+    pll->in_window = 0;
+    pll->integ_ns = 0;
+    pll->jump_ns = 0;
+    WRITE_ONCE(pll->p_corr_ns, 0);
+    WRITE_ONCE(pll->i_corr_ns, 0);
+    WRITE_ONCE(pll->locked, false);
+    WRITE_ONCE(pll->phase_err_max_ns, 0);
+    WRITE_ONCE(pll->ref, ref);
+    WRITE_ONCE(pll->ref_phase_ns, phase_ns);
+    pll->jump = ref == PLL_REF_CLOCK;
+    // the settings before enabled, both update paths run on other CPUs
+    smp_store_release(&pll->enabled, on);
+}
+
+void pll_set_enabled(struct myrt_core *core, bool on)
+{
+    pll_start(core, PLL_REF_CAPTURE, 0, on);
+}
+
+void pll_align_clock(struct myrt_core *core, s64 phase_ns)
+{
+    pll_start(core, PLL_REF_CLOCK, phase_ns, true);
+}
+
+// ====== Capture ======
+static int capture_level(struct capture_chan *cap)
+{
+#if USE_GPIOD == 0
+    return gpio_get_value(cap->core->meas_pins[cap->ch]);
+#else
+    return gpiod_get_value(cap->core->meas_gpios->desc[cap->ch]);
+#endif
+}
+
+// Period between two accepted edges, 0 while there is no previous edge
+u64 capture_period_ns(ktime_t now, ktime_t last_edge)
+{
+    if (!ktime_to_ns(last_edge))
+        return 0;
+    return ktime_to_ns(ktime_sub(now, last_edge));
+}
+
+// An edge closer than min_ns (0 = off) to the last accepted one
+bool capture_too_close(ktime_t now, ktime_t last_edge, u32 min_ns)
+{
+    return min_ns && ktime_to_ns(ktime_sub(now, last_edge)) < min_ns;
+}
+
+// Running mean (1/16 per edge) of the change between consecutive periods.
+// On a steady input that change is the difference of two timestamp errors.
+u32 capture_jitter_ns(u32 jitter_ns, s64 prev_period_ns, s64 period_ns)
+{
+    s64 d = period_ns - prev_period_ns;
+
+    if (d < 0)
+        d = -d;
+    return jitter_ns + div_s64(d - jitter_ns, 16);
+}
+
+// An edge that made it through the glitch filter. A software timestamp
+// has no known error; half the period jitter stands in for it.
+static void capture_accept(struct capture_chan *cap, ktime_t now,
+                           u8 src, u32 err_ns)
+{
+    struct myrt_core *core = cap->core;
+    unsigned long flags;
+    s64 period_ns = capture_period_ns(now, cap->st.last_edge);
+
+    if (period_ns) {
+        if (cap->last_period_ns)
+            cap->jitter_ns = capture_jitter_ns(cap->jitter_ns, cap->last_period_ns,
+                                               period_ns);
+    }
+    cap->last_period_ns = period_ns;
+    if (src == CAPTURE_TS_SW)
+        err_ns = cap->jitter_ns / 2;
+
+    raw_spin_lock_irqsave(&cap->st_lock, flags);
+    write_seqcount_begin(&cap->st_seq);
+    // the first edge only arms the measurement
+    cap->st.period_ns = period_ns;
+    cap->st.last_edge = now;
+    cap->st.edges++;
+    cap->st.ts_src = src;
+    cap->st.ts_err_ns = err_ns;
+    write_seqcount_end(&cap->st_seq);
+    raw_spin_unlock_irqrestore(&cap->st_lock, flags);
+    // channel 0 is the PLL reference
+    if (cap->ch == 0 && READ_ONCE(core->pll.enabled) &&
+        READ_ONCE(core->pll.ref) == PLL_REF_CAPTURE)
+        pll_update(core, now);
+    if (core->capture_hook)
+        core->capture_hook(cap, now);
+}
+
+static void capture_reject(struct capture_chan *cap)
+{
+    unsigned long flags;
+
+    raw_spin_lock_irqsave(&cap->st_lock, flags);
+    write_seqcount_begin(&cap->st_seq);
+    cap->st.rejected++;
+    write_seqcount_end(&cap->st_seq);
+    raw_spin_unlock_irqrestore(&cap->st_lock, flags);
+}
+
+void capture_snapshot(struct capture_chan *cap, struct capture_stats *st)
+{
+    unsigned int seq;
+
+    do {
+        seq = read_seqcount_begin(&cap->st_seq);
+        *st = cap->st;
+    } while (read_seqcount_retry(&cap->st_seq, seq));
+}
+
+// The level is still there resample_ns after the edge: it was a real one.
+// When deferring, only the level is read here; the drain accepts the edge
+// in its own context like every other one, see capture_resample_done.
+static enum hrtimer_restart resample_timer_callback(struct hrtimer *timer)
+{
+    struct capture_chan *cap = container_of(timer, struct capture_chan, resample_timer);
+    struct myrt_core *core = cap->core;
+    bool high = capture_level(cap);
+
+    if (core->capture_kick) {
+        smp_store_release(&cap->resample_level, high ? RESAMPLE_HIGH : RESAMPLE_LOW);
+        core->capture_kick(core);
+        return HRTIMER_NORESTART;
+    }
+    if (high)
+        capture_accept(cap, cap->pending, cap->pending_src, cap->pending_err_ns);
+    else
+        capture_reject(cap);
+    smp_store_release(&cap->resample_busy, false);
+    return HRTIMER_NORESTART;
+}
+
+// Deferred: finish the pending edge once the timer has read its level.
+// From the drain only. Returns whether there was one.
+static bool capture_resample_done(struct capture_chan *cap)
+{
+    u8 level = smp_load_acquire(&cap->resample_level);
+
+    if (level == RESAMPLE_WAIT)
+        return false;
+    if (level == RESAMPLE_HIGH)
+        capture_accept(cap, cap->pending, cap->pending_src, cap->pending_err_ns);
+    else
+        capture_reject(cap);
+    cap->resample_level = RESAMPLE_WAIT;
+    smp_store_release(&cap->resample_busy, false);
+    return true;
+}
+
+void capture_set_deglitch(struct capture_chan *cap, u32 min_ns, u32 resample_ns)
+{
+    WRITE_ONCE(cap->deglitch_ns, min_ns);
+    WRITE_ONCE(cap->resample_ns, resample_ns);
+}
+
+// ====== MEAS_IN rising edges ======
+// From capture_push, or capture_drain when the caller defers
+void capture_edge(struct capture_chan *cap, ktime_t now, enum capture_ts_src src,
+                  u32 err_ns)
+{
+    u32 min_ns = READ_ONCE(cap->deglitch_ns);
+    u32 resample_ns = READ_ONCE(cap->resample_ns);
+
+    // a resample that came in since the last drain goes first
+    if (cap->core->capture_kick)
+        capture_resample_done(cap);
+    // bounce while the previous edge waits for its resample
+    if (smp_load_acquire(&cap->resample_busy)) {
+        capture_reject(cap);
+        return;
+    }
+    // closer to the last accepted edge than any real signal can be
+    if (capture_too_close(now, cap->st.last_edge, min_ns)) {
+        capture_reject(cap);
+        return;
+    }
+    if (resample_ns) {
+        cap->pending = now;
+        cap->pending_src = src;
+        cap->pending_err_ns = err_ns;
+        cap->resample_busy = true;
+        // resample_ns after the edge, not after the drain got to it; a
+        // queue that held it longer than that has the level read at once
+        hrtimer_start(&cap->resample_timer, ktime_add_ns(now, resample_ns),
+                      HRTIMER_MODE_ABS);
+        return;
+    }
+    capture_accept(cap, now, src, err_ns);
+}
+
+static void capture_stage_add(struct capture_stage_stats *s, s64 ns)
+{
+    u32 v = clamp_t(s64, ns, 0, U32_MAX);
+
+    WRITE_ONCE(s->count, s->count + 1);
+    WRITE_ONCE(s->sum_ns, s->sum_ns + v);
+    if (v > s->max_ns)
+        WRITE_ONCE(s->max_ns, v);
+}
+
+// Hard IRQ half. Without capture_kick the whole path runs here; with it
+// only the queueing does, which is all the hard IRQ time an edge costs.
+void capture_push(struct capture_chan *cap, ktime_t ts, enum capture_ts_src src,
+                  u32 err_ns)
+{
+    struct myrt_core *core = cap->core;
+    struct capture_raw raw = { .ts = ts, .err_ns = err_ns, .src = src };
+
+    if (!core->capture_kick) {
+        capture_edge(cap, ts, src, err_ns);
+        capture_stage_add(&cap->stage[CAPTURE_STAGE_IRQ],
+                          ktime_to_ns(ktime_sub(ktime_get(), ts)));
+        return;
+    }
+    raw.queued = ktime_get();
+    if (!kfifo_put(&cap->queue, raw))
+        WRITE_ONCE(cap->queue_lost, cap->queue_lost + 1);
+    capture_stage_add(&cap->stage[CAPTURE_STAGE_IRQ],
+                      ktime_to_ns(ktime_sub(raw.queued, ts)));
+    core->capture_kick(core);
+}
+
+void capture_drain(struct myrt_core *core)
+{
+    struct capture_raw raw;
+    unsigned int ch;
+    ktime_t t0;
+
+    for (ch = 0; ch < core->n_meas; ch++) {
+        struct capture_chan *cap = &core->caps[ch];
+
+        t0 = ktime_get();
+        if (capture_resample_done(cap))
+            capture_stage_add(&cap->stage[CAPTURE_STAGE_WORK],
+                              ktime_to_ns(ktime_sub(ktime_get(), t0)));
+        while (kfifo_get(&cap->queue, &raw)) {
+            t0 = ktime_get();
+            capture_stage_add(&cap->stage[CAPTURE_STAGE_QUEUE],
+                              ktime_to_ns(ktime_sub(t0, raw.queued)));
+            capture_edge(cap, raw.ts, raw.src, raw.err_ns);
+            capture_stage_add(&cap->stage[CAPTURE_STAGE_WORK],
+                              ktime_to_ns(ktime_sub(ktime_get(), t0)));
+        }
+    }
+}
+
+// The timestamp is taken first thing; the IRQ is requested IRQF_NO_THREAD
+// where that is safe, so forced IRQ threading does not delay it.
+irqreturn_t gpio_irq_handler(int irq, void *dev_id)
+{
+    capture_push(dev_id, ktime_get(), CAPTURE_TS_SW, 0);
+    return IRQ_HANDLED;
+}
+
+// ====== PWM output ======
+// Drive all PWM pins to 'levels' at once. The gpiod array setter hands the
+// whole bitmap to the chip in one call, and takes the single-register fast
+// path when the pins share a bank (pwm_gpios->info is set), so edges that
+// fall on the same step land together. Lines that can sleep are written
+// by pwm_write_levels instead, see pwm_kick.
+static void pwm_apply_levels(struct myrt_core *core, unsigned long levels)
+{
+#if USE_GPIOD == 0
+    unsigned long changed = levels ^ core->pwm_state;
+    unsigned int ch;
+
+    for_each_set_bit(ch, &changed, core->n_pwm)
+        gpio_set_value(core->pwm_pins[ch], !!(levels & BIT(ch)));
+#else
+    if (core->pwm_kick) {
+        WRITE_ONCE(core->pwm_state, levels);
+        core->pwm_kick(core);
+        return;
+    }
+    gpiod_set_array_value(core->pwm_gpios->ndescs, core->pwm_gpios->desc,
+                          core->pwm_gpios->info, &levels);
+#endif
+    core->pwm_state = levels;
+}
+
+// The levels the timer (or pwm_estop) last set, each time it kicked. A kick
+// while this runs has it run once more, so the lines end up at the last
+// levels, all low after an e-stop; steps in between may be passed over.
+void pwm_write_levels(struct myrt_core *core)
+{
+#if USE_GPIOD != 0
+    unsigned long levels = READ_ONCE(core->pwm_state);
+
+    gpiod_set_array_value_cansleep(core->pwm_gpios->ndescs, core->pwm_gpios->desc,
+                                   core->pwm_gpios->info, &levels);
+#endif
+}
+
+// New commanded duty. Without a slew rate it is what the steps run with
+// right away; with one, pwm_slew moves the output there period by period.
+// Called with core->lock held.
+static void pwm_command_duty(struct myrt_core *core, unsigned int ch, int duty)
+{
+    core->duty_target[ch] = duty;
+    if (!(core->slew_mask & BIT(ch)))
+        WRITE_ONCE(core->duty_cycle[ch], duty);
+}
+
+// Takes effect right away, mid-period. Also updates a pending staged
+// state, which would otherwise bring the old duty back at the latch.
+void pwm_set_duty(struct myrt_core *core, unsigned int ch, int duty)
+{
+    unsigned long flags;
+
+    duty = clamp(duty, 0, 100);
+    spin_lock_irqsave(&core->lock, flags);
+    pwm_command_duty(core, ch, duty);
+    if (core->next.dirty)
+        core->next.duty[ch] = duty;
+    spin_unlock_irqrestore(&core->lock, flags);
+}
+
+// ====== Duty shaping ======
+// Linear interpolation in a table of duties at every 10 % of speed, for
+// outputs whose effect is not proportional to duty (fan curves, dead zone
+// of a motor driver). Done when the speed is written, not per step.
+int pwm_lut_map(const u8 *lut, int speed)
+{
+    int i, frac;
+
+    speed = clamp(speed, 0, 100);
+    i = speed / 10;
+    frac = speed % 10;
+    if (!frac)
+        return lut[i];
+    return lut[i] + DIV_ROUND_CLOSEST((lut[i + 1] - lut[i]) * frac, 10);
+}
+
+void pwm_set_speed(struct myrt_core *core, unsigned int ch, int speed)
+{
+    unsigned long flags;
+    int duty = speed;
+
+    spin_lock_irqsave(&core->lock, flags);
+    if (core->lut_mask & BIT(ch))
+        duty = pwm_lut_map(core->lut[ch], speed);
+    spin_unlock_irqrestore(&core->lock, flags);
+    pwm_set_duty(core, ch, duty);
+}
+
+int pwm_set_lut(struct myrt_core *core, unsigned int ch, const int *points)
+{
+    unsigned long flags;
+    unsigned int i;
+
+    if (ch >= core->n_pwm)
+        return -EINVAL;
+    for (i = 0; points && i < PWM_LUT_POINTS; i++) {
+        if (points[i] < 0 || points[i] > 100)
+            return -EINVAL;
+    }
+    spin_lock_irqsave(&core->lock, flags);
+    if (points) {
+        for (i = 0; i < PWM_LUT_POINTS; i++)
+            core->lut[ch][i] = points[i];
+        core->lut_mask |= BIT(ch);
+    } else {
+        core->lut_mask &= ~BIT(ch);
+    }
+    spin_unlock_irqrestore(&core->lock, flags);
+    return 0;
+}
+
+int pwm_set_slew(struct myrt_core *core, unsigned int ch, u32 rate)
+{
+    unsigned long flags;
+
+    if (ch >= core->n_pwm)
+        return -EINVAL;
+    // keeps rate * period << 16 in pwm_slew within u64
+    rate = min_t(u32, rate, PWM_SLEW_MAX);
+    spin_lock_irqsave(&core->lock, flags);
+    if (rate && !(core->slew_mask & BIT(ch))) {
+        // start from what the channel runs with now
+        core->duty_q16[ch] = (u32)core->duty_cycle[ch] << 16;
+        core->slew_mask |= BIT(ch);
+    } else if (!rate) {
+        core->slew_mask &= ~BIT(ch);
+        WRITE_ONCE(core->duty_cycle[ch], core->duty_target[ch]);
+    }
+    core->slew_rate[ch] = rate;
+    spin_unlock_irqrestore(&core->lock, flags);
+    return 0;
+}
+
+// One period's move of a slewed duty towards target, at most step_q16
+u32 pwm_slew_step(u32 duty_q16, int target, u32 step_q16)
+{
+    u32 t = (u32)target << 16;
+
+    if (duty_q16 < t)
+        return t - duty_q16 > step_q16 ? duty_q16 + step_q16 : t;
+    return duty_q16 - t > step_q16 ? duty_q16 - step_q16 : t;
+}
+
+// From pwm_timer_callback at counter 0, after the latch, so the step
+// matches the period that starts now
+static void pwm_slew(struct myrt_core *core)
+{
+    unsigned long mask;
+    unsigned int ch;
+    u32 step;
+
+    spin_lock(&core->lock);
+    mask = core->slew_mask;
+    for_each_set_bit(ch, &mask, core->n_pwm) {
+        step = div_u64(((u64)core->slew_rate[ch] * core->period_ns) << 16,
+                       NSEC_PER_SEC);
+        core->duty_q16[ch] = pwm_slew_step(core->duty_q16[ch],
+                                           core->duty_target[ch], max(step, 1u));
+        WRITE_ONCE(core->duty_cycle[ch], (core->duty_q16[ch] + 0x8000) >> 16);
+    }
+    spin_unlock(&core->lock);
+}
+
+// Start a staged state from what runs now. Called with core->lock held.
+static void pwm_stage_begin(struct myrt_core *core)
+{
+    if (core->next.dirty)
+        return;
+    memcpy(core->next.duty, core->duty_target, sizeof(core->next.duty));
+    core->next.polarity = core->polarity;
+    core->next.period_ns = core->period_ns;
+}
+
+// takes effect at the next period start, so no period is cut short
+int pwm_set_period(struct myrt_core *core, u32 period_ns)
+{
+    unsigned long flags;
+
+    if (period_ns < PWM_PERIOD_MIN_NS || period_ns > PWM_PERIOD_MAX_NS)
+        return -EINVAL;
+    spin_lock_irqsave(&core->lock, flags);
+    pwm_stage_begin(core);
+    core->next.period_ns = period_ns;
+    WRITE_ONCE(core->next.dirty, true);
+    spin_unlock_irqrestore(&core->lock, flags);
+    return 0;
+}
+
+int pwm_stage(struct myrt_core *core, unsigned int ch, u32 period_ns,
+              int duty, bool inverted)
+{
+    unsigned long flags;
+
+    if (period_ns < PWM_PERIOD_MIN_NS || period_ns > PWM_PERIOD_MAX_NS)
+        return -EINVAL;
+    spin_lock_irqsave(&core->lock, flags);
+    pwm_stage_begin(core);
+    core->next.period_ns = period_ns;
+    core->next.duty[ch] = clamp(duty, 0, 100);
+    if (inverted)
+        core->next.polarity |= BIT(ch);
+    else
+        core->next.polarity &= ~BIT(ch);
+    WRITE_ONCE(core->next.dirty, true);
+    spin_unlock_irqrestore(&core->lock, flags);
+    return 0;
+}
+
+void pwm_get_staged(struct myrt_core *core, unsigned int ch, u32 *period_ns,
+                    int *duty, bool *inverted)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&core->lock, flags);
+    if (core->next.dirty) {
+        *period_ns = core->next.period_ns;
+        *duty = core->next.duty[ch];
+        *inverted = core->next.polarity & BIT(ch);
+    } else {
+        *period_ns = core->period_ns;
+        *duty = core->duty_target[ch];
+        *inverted = core->polarity & BIT(ch);
+    }
+    spin_unlock_irqrestore(&core->lock, flags);
+}
+
+// Take over the staged state. Called from pwm_timer_callback at counter 0.
+static void pwm_latch(struct myrt_core *core)
+{
+    unsigned int ch;
+
+    spin_lock(&core->lock);
+    for (ch = 0; ch < MAX_PWM_CH; ch++)
+        pwm_command_duty(core, ch, core->next.duty[ch]);
+    core->polarity = core->next.polarity;
+    WRITE_ONCE(core->period_ns, core->next.period_ns);
+    core->next.dirty = false;
+    spin_unlock(&core->lock);
+}
+
+// Output levels at step 'counter': channel n is high for its first
+// duty[n] steps of the period
+unsigned long pwm_levels(const int *duty, unsigned int n, int counter)
+{
+    unsigned long levels = 0;
+    unsigned int ch;
+
+    for (ch = 0; ch < n; ch++) {
+        if (counter < READ_ONCE(duty[ch]))
+            levels |= BIT(ch);
+    }
+    return levels;
+}
+
+// ====== Emergency stop ======
+// Every pin write of the engine happens under out_lock and is skipped once
+// estopped is set, so a timer callback racing the stop on another CPU
+// cannot drive a pin back high. The work here is one array write, the
+// latency from 'edge' to the pins being low is recorded every time.
+void pwm_estop(struct myrt_core *core, ktime_t edge)
+{
+    unsigned long flags;
+    u32 lat;
+
+    raw_spin_lock_irqsave(&core->out_lock, flags);
+    WRITE_ONCE(core->estopped, true);
+    pwm_apply_levels(core, 0);
+    lat = ktime_to_ns(ktime_sub(ktime_get(), edge));
+    raw_spin_unlock_irqrestore(&core->out_lock, flags);
+
+    // a running callback sees estopped on its next expiry and ends there
+    hrtimer_try_to_cancel(&core->pwm_timer);
+    WRITE_ONCE(core->estops, core->estops + 1);
+    WRITE_ONCE(core->estop_latency_ns, lat);
+    if (lat > core->estop_latency_max_ns)
+        WRITE_ONCE(core->estop_latency_max_ns, lat);
+}
+
+void pwm_rearm(struct myrt_core *core)
+{
+    unsigned long flags;
+    unsigned int ch;
+
+    if (!READ_ONCE(core->estopped))
+        return;
+    hrtimer_cancel(&core->pwm_timer);
+    for (ch = 0; ch < core->n_pwm; ch++)
+        pwm_set_duty(core, ch, 0);
+    // slewed channels restart from 0 as well, not from before the stop
+    spin_lock_irqsave(&core->lock, flags);
+    for (ch = 0; ch < core->n_pwm; ch++) {
+        core->duty_q16[ch] = 0;
+        WRITE_ONCE(core->duty_cycle[ch], 0);
+    }
+    spin_unlock_irqrestore(&core->lock, flags);
+    // the first step is the start of a new period
+    core->counter = 99;
+    core->skipped = 0;
+    WRITE_ONCE(core->estopped, false);
+    myrt_core_start(core);
+}
+
+// ====== Heartbeat watchdog ======
+// The control loop in userspace pings; if it stops, every duty is walked
+// to the safe value instead of holding the last command forever. Checked
+// once per period, so a miss is seen at most one period late.
+int pwm_wdt_set(struct myrt_core *core, u32 deadline_ns, int safe_duty, int slew)
+{
+    struct myrt_wdt *wdt = &core->wdt;
+    unsigned long flags;
+
+    if (deadline_ns && slew <= 0)
+        return -EINVAL;
+    spin_lock_irqsave(&core->lock, flags);
+    wdt->safe_duty = clamp(safe_duty, 0, 100);
+    wdt->slew = slew;
+    wdt->last_ping = ktime_get();
+    wdt->expired = false;
+    WRITE_ONCE(wdt->deadline_ns, deadline_ns);
+    spin_unlock_irqrestore(&core->lock, flags);
+    return 0;
+}
+
+void pwm_wdt_ping(struct myrt_core *core)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&core->lock, flags);
+    core->wdt.last_ping = ktime_get();
+    WRITE_ONCE(core->wdt.expired, false);
+    spin_unlock_irqrestore(&core->lock, flags);
+}
+
+// From pwm_timer_callback at counter 0. Moves the commanded duties (and a
+// staged state, which would bring them back at the next latch); a channel
+// slew rate applies on top.
+static void pwm_wdt_check(struct myrt_core *core, ktime_t now)
+{
+    struct myrt_wdt *wdt = &core->wdt;
+    unsigned int ch;
+    int duty;
+
+    spin_lock(&core->lock);
+    if (ktime_to_ns(ktime_sub(now, wdt->last_ping)) <= wdt->deadline_ns) {
+        spin_unlock(&core->lock);
+        return;
+    }
+    if (!wdt->expired) {
+        WRITE_ONCE(wdt->expired, true);
+        WRITE_ONCE(wdt->misses, wdt->misses + 1);
+    }
+    // only ever down: a channel already below the safe duty stays there
+    for (ch = 0; ch < core->n_pwm; ch++) {
+        duty = core->duty_target[ch];
+        if (duty <= wdt->safe_duty)
+            continue;
+        duty = max(duty - wdt->slew, wdt->safe_duty);
+        pwm_command_duty(core, ch, duty);
+        if (core->next.dirty)
+            core->next.duty[ch] = duty;
+    }
+    spin_unlock(&core->lock);
+}
+
+// ====== hrtimer callback for PWM ======
+// One expiry of the PWM timer, run at 'now'. The callback passes the clock;
+// the KUnit tests step it with made up times on a timer never started.
+enum hrtimer_restart pwm_timer_step(struct myrt_core *core, ktime_t now)
+{
+    struct hrtimer *timer = &core->pwm_timer;
+    unsigned long levels;
+    ktime_t interval;
+    u32 step, rem;
+    s64 corr = 0;
+    u64 orun;
+
+    if (READ_ONCE(core->estopped))
+        return HRTIMER_NORESTART;
+    // steps a late wakeup skipped are passed over, so the levels stay where
+    // the period really is; a period start among them is still taken, with
+    // the time it was due
+    step = core->counter + 1 + core->skipped;
+    core->skipped = 0;
+    core->counter = step % 100;
+    if (step >= 100) {
+        WRITE_ONCE(core->period_start,
+                   ktime_sub(hrtimer_get_expires(timer),
+                             ns_to_ktime((u64)core->counter * (core->period_ns / 100))));
+        if (READ_ONCE(core->next.dirty))
+            pwm_latch(core);
+        if (READ_ONCE(core->pll.enabled) && READ_ONCE(core->pll.ref) == PLL_REF_CLOCK)
+            pll_clock_update(core);
+        if (READ_ONCE(core->wdt.deadline_ns))
+            pwm_wdt_check(core, hrtimer_get_expires(timer));
+        if (READ_ONCE(core->slew_mask))
+            pwm_slew(core);
+    }
+    levels = pwm_levels(core->duty_cycle, core->n_pwm, core->counter) ^ core->polarity;
+    // only touch the pins when some channel actually switches on this step
+    if (levels != core->pwm_state) {
+        raw_spin_lock(&core->out_lock);
+        if (!core->estopped)
+            pwm_apply_levels(core, levels);
+        raw_spin_unlock(&core->out_lock);
+    }
+    if (core->pwm_step_hook)
+        core->pwm_step_hook(core, core->counter);
+
+    interval = ktime_set(0, core->period_ns / 100); // divide into 100 steps
+    if (core->counter == 99 && READ_ONCE(core->pll.enabled))
+        corr = pll_take_correction(&core->pll, core->period_ns,
+                                   hrtimer_get_expires(timer));
+    // woke up later than a whole step: the missed steps are skipped, the
+    // timer stays on its grid and the counter moves on with it. Lost whole
+    // periods only need their last period start.
+    orun = hrtimer_forward(timer, now, interval);
+    // the PLL stretches the period once, however many steps were skipped
+    if (corr)
+        hrtimer_add_expires_ns(timer, corr);
+    if (orun > 1) {
+        WRITE_ONCE(core->overruns, core->overruns + orun - 1);
+        if (orun - 1 < 100) {
+            core->skipped = orun - 1;
+        } else {
+            div_u64_rem(orun - 1, 100, &rem);
+            core->skipped = 100 + rem;
+        }
+    }
+    return HRTIMER_RESTART;
+}
+
+static enum hrtimer_restart pwm_timer_callback(struct hrtimer *timer)
+{
+    struct myrt_core *core = container_of(timer, struct myrt_core, pwm_timer);
+
+    return pwm_timer_step(core, ktime_get());
+}
+
+// ====== Init & Exit ======
+void myrt_core_init(struct myrt_core *core)
+{
+    unsigned int ch;
+
+    for (ch = 0; ch < MAX_PWM_CH; ch++)
+        core->duty_cycle[ch] = core->duty_target[ch] = 50;
+    core->pwm_state = 0;
+    core->counter = 0;
+    core->skipped = 0;
+    core->period_ns = PWM_PERIOD_NS;
+    core->polarity = 0;
+    core->next.dirty = false;
+    spin_lock_init(&core->lock);
+    raw_spin_lock_init(&core->out_lock);
+    hrtimer_init(&core->pwm_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    core->pwm_timer.function = pwm_timer_callback;
+
+    for (ch = 0; ch < core->n_meas; ch++) {
+        struct capture_chan *cap = &core->caps[ch];
+
+        cap->core = core;
+        cap->ch = ch;
+        cap->st.last_edge = ktime_set(0,0);
+        raw_spin_lock_init(&cap->st_lock);
+        seqcount_raw_spinlock_init(&cap->st_seq, &cap->st_lock);
+        hrtimer_init(&cap->resample_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+        cap->resample_timer.function = resample_timer_callback;
+        INIT_KFIFO(cap->queue);
+    }
+}
+
+void myrt_core_start(struct myrt_core *core)
+{
+    hrtimer_start(&core->pwm_timer, ktime_set(0, core->period_ns / 100), HRTIMER_MODE_REL);
+}
+
+// the capture IRQs must be freed before, so no resample gets rearmed
+void myrt_core_stop(struct myrt_core *core)
+{
+    unsigned int ch;
+
+    hrtimer_cancel(&core->pwm_timer);
+    for (ch = 0; ch < core->n_meas; ch++)
+        hrtimer_cancel(&core->caps[ch].resample_timer);
+}
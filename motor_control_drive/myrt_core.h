@@ -0,0 +1,267 @@
+// myrt_core.h
+// PWM scheduling, capture and edge filtering of myrt. Nothing in here knows
+// about the char device, sysfs or module parameters, so the same sources
+// build into the module and, against the mock headers in user/include, into
+// a userspace library driven by a virtual clock.
+#ifndef MYRT_CORE_H
+#define MYRT_CORE_H
+
+#define USE_GPIOD   (1)
+
+#include <linux/types.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>
+#include <linux/spinlock.h>
+#include <linux/seqlock.h>
+#include <linux/kfifo.h>
+#if USE_GPIOD == 0
+#include <linux/gpio.h>
+#else
+#include <linux/gpio/consumer.h>   // new GPIO descriptor API
+#endif
+
+#define MAX_PWM_CH  8    // PWM channels, one bit each in pwm_state
+#define MAX_CAP_CH  4    // capture channels
+#define CAPTURE_QUEUE_LEN   16  // edges between the hard IRQ and deferred work
+
+// PWM config (1 kHz default), every period is 100 steps
+#define PWM_PERIOD_NS 1000000L   // 1 ms = 1 kHz
+#define PWM_STEP_NS   (PWM_PERIOD_NS/100)
+#define PWM_PERIOD_MIN_NS 100000L     // 10 kHz, 1 us steps
+#define PWM_PERIOD_MAX_NS 100000000L  // 10 Hz
+#define PWM_LUT_POINTS  11              // speed 0, 10, .. 100 %
+#define PWM_SLEW_MAX    1000000         // points/s, 0..100 % within the shortest period
+
+struct myrt_core;
+
+// where an edge timestamp came from
+enum capture_ts_src {
+    CAPTURE_TS_SW,              // ktime_get() on entry of the hard IRQ handler
+    CAPTURE_TS_HTE,             // hardware timestamp engine, latched at the pin
+};
+
+// an edge as the hard IRQ saw it, waiting for capture_drain()
+struct capture_raw {
+    ktime_t ts;
+    ktime_t queued;
+    u32 err_ns;
+    u8 src;
+};
+
+// where an edge spends its time
+enum capture_stage {
+    CAPTURE_STAGE_IRQ,          // timestamp to end of the hard IRQ part
+    CAPTURE_STAGE_QUEUE,        // queued to picked up by the deferred work
+    CAPTURE_STAGE_WORK,         // filter, PLL and consumers in the deferred work
+    CAPTURE_STAGES,
+};
+
+struct capture_stage_stats {
+    u64 count;
+    u64 sum_ns;
+    u32 max_ns;
+};
+
+// level read by the resample timer, handed to the drain when deferring
+enum capture_resample { RESAMPLE_WAIT, RESAMPLE_HIGH, RESAMPLE_LOW };
+
+// measurement state of one capture channel, read as a whole through
+// capture_snapshot() so 64-bit fields never tear on 32-bit kernels
+struct capture_stats {
+    ktime_t last_edge;          // last accepted edge
+    u64 period_ns;              // last_edge minus the edge before, 0 = none yet
+    u64 edges;                  // accepted, also the sequence number of last_edge
+    u64 rejected;               // too close, or level gone at the resample
+    u32 ts_err_ns;              // estimated error of last_edge
+    u8 ts_src;                  // enum capture_ts_src of last_edge
+};
+
+// one per MEAS_IN pin
+struct capture_chan {
+    struct myrt_core *core;
+    unsigned int ch;
+    int irq;
+    // written by the IRQ handler and the resample timer only
+    struct capture_stats st;
+    raw_spinlock_t st_lock;     // the two writers
+    seqcount_raw_spinlock_t st_seq;
+    u32 deglitch_ns;            // min interval to the last accepted edge
+    u32 resample_ns;            // re-read the level this long after the edge, 0 = off
+    s64 last_period_ns;
+    u32 jitter_ns;              // mean period-to-period change, for the SW error
+    struct hrtimer resample_timer;
+    ktime_t pending;            // edge waiting for its resample
+    u8 pending_src;
+    u32 pending_err_ns;
+    bool resample_busy;
+    u8 resample_level;          // deferred: enum capture_resample, for the drain
+    // deferred processing, single producer (the hard IRQ) and consumer
+    DECLARE_KFIFO(queue, struct capture_raw, CAPTURE_QUEUE_LEN);
+    u64 queue_lost;             // edges dropped on a full queue
+    struct capture_stage_stats stage[CAPTURE_STAGES];
+};
+
+// heartbeat watchdog, checked at every period start
+struct myrt_wdt {
+    u32 deadline_ns;        // max time between pings, 0 = off
+    int safe_duty;          // percent, higher duties are ramped down to it
+    int slew;               // duty points per period on the way there
+    ktime_t last_ping;      // under core->lock
+    bool expired;
+    u64 misses;             // deadlines missed
+};
+
+// what the PLL locks the PWM period starts to
+enum pll_ref {
+    PLL_REF_CAPTURE,        // rising edges of capture channel 0
+    PLL_REF_CLOCK,          // multiples of the period on core->pll_ref_clock
+};
+
+// phase lock of the PWM period to capture channel 0 or a clock
+struct myrt_pll {
+    int kp_shift;           // P gain, 1/2^n of the phase error
+    int ki_shift;           // I gain, 1/2^n of the summed phase error
+    int lock_ns;            // phase error window counted as locked
+    bool enabled;
+    bool locked;
+    int ref;                // enum pll_ref
+    s64 ref_phase_ns;       // clock: period starts this far after the multiples
+    bool jump;              // clock: move the next period start onto the grid at once
+    s64 jump_ns;            // the stretch of the last step that does it
+    u64 jumps;
+    int in_window;          // consecutive edges within lock_ns
+    s64 phase_err_ns;       // last edge minus nearest PWM period start
+    s64 phase_err_max_ns;   // largest magnitude since enabled, jumps aside
+    s64 integ_ns;
+    s64 p_corr_ns;
+    s64 i_corr_ns;
+    ktime_t last_edge;
+};
+
+struct myrt_core {
+#if USE_GPIOD == 0
+    const int *pwm_pins;
+    const int *meas_pins;
+#else
+    struct gpio_descs *pwm_gpios;
+    struct gpio_descs *meas_gpios;
+#endif
+    unsigned int n_pwm;
+    unsigned int n_meas;
+
+    // PWM engine
+    struct hrtimer pwm_timer;
+    int counter;                        // step within the period, 0..99
+    u32 skipped;                        // steps the next expiry passes over
+    u32 period_ns;                      // of the running period
+    unsigned long polarity;             // inverted channels, XORed onto the levels
+    int duty_cycle[MAX_PWM_CH];         // percent, what the steps run with
+    int duty_target[MAX_PWM_CH];        // commanded, duty_cycle follows it
+    // per-period shaping of the commanded duty, under lock
+    u32 slew_rate[MAX_PWM_CH];          // duty points per second, 0 = off
+    u32 duty_q16[MAX_PWM_CH];           // slewed duty, 16 fractional bits
+    unsigned long slew_mask;            // channels with a slew rate
+    u8 lut[MAX_PWM_CH][PWM_LUT_POINTS]; // speed -> duty, see pwm_set_speed
+    unsigned long lut_mask;             // channels with a table
+    unsigned long pwm_state;            // current output levels, bit n = channel n
+    ktime_t period_start;               // expiry of the step that began this period
+    u64 overruns;                       // steps skipped because the timer ran late
+    // emergency stop: outputs low, timer stopped until pwm_rearm()
+    raw_spinlock_t out_lock;            // pin writes against pwm_estop
+    bool estopped;
+    u64 estops;
+    u32 estop_latency_ns;               // last, from the stop edge to all pins low
+    u32 estop_latency_max_ns;
+    // settings taken over together at the next period start
+    spinlock_t lock;
+    struct {
+        bool dirty;
+        u32 period_ns;
+        int duty[MAX_PWM_CH];
+        unsigned long polarity;
+    } next;
+    // extra per-step work of the caller (BLDC chop), may be NULL
+    void (*pwm_step_hook)(struct myrt_core *core, int counter);
+    // called for every accepted capture edge (counter, IIO), may be NULL
+    void (*capture_hook)(struct capture_chan *cap, ktime_t edge);
+    // set: the hard IRQ only queues the edge and calls this to have
+    // capture_drain() run elsewhere (irq_work, kthread); NULL = inline
+    void (*capture_kick)(struct myrt_core *core);
+    // set: the PWM lines can sleep, the timer only records the levels in
+    // pwm_state and calls this to have pwm_write_levels() run in a kthread
+    void (*pwm_kick)(struct myrt_core *core);
+    // the PLL's reference clock for PLL_REF_CLOCK: 'mono' on its time
+    // scale. Called from the PWM timer at every period start.
+    ktime_t (*pll_ref_clock)(struct myrt_core *core, ktime_t mono);
+
+    struct myrt_wdt wdt;
+    struct myrt_pll pll;
+    struct capture_chan caps[MAX_CAP_CH];
+};
+
+// pins, n_pwm and n_meas must be set before myrt_core_init()
+void myrt_core_init(struct myrt_core *core);
+void myrt_core_start(struct myrt_core *core);
+void myrt_core_stop(struct myrt_core *core);
+
+// the commanded duty; with a slew rate the output gets there at that rate
+void pwm_set_duty(struct myrt_core *core, unsigned int ch, int duty);
+// speed in percent through the channel's table, pwm_set_duty without one
+void pwm_set_speed(struct myrt_core *core, unsigned int ch, int speed);
+// points[PWM_LUT_POINTS] are the duties at speed 0, 10, .. 100, NULL = none
+int pwm_set_lut(struct myrt_core *core, unsigned int ch, const int *points);
+// max duty change in points per second, 0 = steps take effect at once;
+// faster rates are PWM_SLEW_MAX, which already is a whole swing per period
+int pwm_set_slew(struct myrt_core *core, unsigned int ch, u32 rate);
+int pwm_set_period(struct myrt_core *core, u32 period_ns);
+// period (shared by all channels), duty and polarity of one channel, all
+// applied at the next period start
+int pwm_stage(struct myrt_core *core, unsigned int ch, u32 period_ns,
+              int duty, bool inverted);
+// the settings the channel will run with from the next period start on
+void pwm_get_staged(struct myrt_core *core, unsigned int ch, u32 *period_ns,
+                    int *duty, bool *inverted);
+// hard IRQ safe: all PWM pins low now, PWM timer stopped, 'edge' is when
+// the stop request was seen
+void pwm_estop(struct myrt_core *core, ktime_t edge);
+// process context: leave the stopped state with every duty at 0
+void pwm_rearm(struct myrt_core *core);
+// process context, behind pwm_kick: put pwm_state on lines that can sleep
+void pwm_write_levels(struct myrt_core *core);
+// one expiry of core->pwm_timer at 'now', what its callback runs
+enum hrtimer_restart pwm_timer_step(struct myrt_core *core, ktime_t now);
+// watchdog: without a ping for deadline_ns the duties ramp down to safe_duty by
+// slew points per period, until the next ping; deadline_ns 0 turns it off
+int pwm_wdt_set(struct myrt_core *core, u32 deadline_ns, int safe_duty, int slew);
+void pwm_wdt_ping(struct myrt_core *core);
+// lock to capture channel 0
+void pll_set_enabled(struct myrt_core *core, bool on);
+// lock the period starts to phase_ns past the multiples of the period on
+// core->pll_ref_clock, which must be set; pll_set_enabled(core, false) ends it
+void pll_align_clock(struct myrt_core *core, s64 phase_ns);
+void capture_set_deglitch(struct capture_chan *cap, u32 min_ns, u32 resample_ns);
+// consistent copy of cap->st, lockless, retries while an edge is recorded
+void capture_snapshot(struct capture_chan *cap, struct capture_stats *st);
+
+// rising-edge handler of one MEAS_IN pin, dev_id is its capture_chan
+irqreturn_t gpio_irq_handler(int irq, void *dev_id);
+// an edge timestamped elsewhere (HTE), err_ns is the source's resolution;
+// processed right away or queued, see capture_kick
+void capture_push(struct capture_chan *cap, ktime_t ts, enum capture_ts_src src,
+                  u32 err_ns);
+// the filter and everything after it, for the queued edges of all channels;
+// never runs concurrently with itself
+void capture_drain(struct myrt_core *core);
+void capture_edge(struct capture_chan *cap, ktime_t ts, enum capture_ts_src src,
+                  u32 err_ns);
+
+// the arithmetic of the hot paths, no state
+unsigned long pwm_levels(const int *duty, unsigned int n, int counter);
+int pwm_lut_map(const u8 *lut, int speed);
+u32 pwm_slew_step(u32 duty_q16, int target, u32 step_q16);
+s32 pll_phase_fold(s64 err, s32 period);
+u64 capture_period_ns(ktime_t now, ktime_t last_edge);
+bool capture_too_close(ktime_t now, ktime_t last_edge, u32 min_ns);
+u32 capture_jitter_ns(u32 jitter_ns, s64 prev_period_ns, s64 period_ns);
+
+#endif
@@ -0,0 +1,313 @@
+// myrt_core_kunit.c
+// KUnit tests of the myrt core arithmetic, of the duty/period setters and
+// of the PWM timer steps. Nothing here starts a timer or touches a line:
+// the steps run through pwm_timer_step with made up times. Built into myrt
+// with CONFIG_MYRT_KUNIT_TEST, see the Kconfig and .kunitconfig next to it.
+
+#include <kunit/test.h>
+#include <linux/hrtimer.h>
+#include <linux/kernel.h>
+#include <linux/limits.h>
+
+#include "myrt_core.h"
+
+// ====== Hot path arithmetic ======
+static void myrt_pwm_levels_test(struct kunit *test)
+{
+    static const int duty[] = { 0, 1, 50, 100 };
+
+    // channel n is high for its first duty[n] steps
+    KUNIT_EXPECT_EQ(test, pwm_levels(duty, 4, 0), 0xeUL);
+    KUNIT_EXPECT_EQ(test, pwm_levels(duty, 4, 1), 0xcUL);
+    KUNIT_EXPECT_EQ(test, pwm_levels(duty, 4, 49), 0xcUL);
+    KUNIT_EXPECT_EQ(test, pwm_levels(duty, 4, 50), 0x8UL);
+    KUNIT_EXPECT_EQ(test, pwm_levels(duty, 4, 99), 0x8UL);
+    // channels past n are left alone
+    KUNIT_EXPECT_EQ(test, pwm_levels(duty, 2, 0), 0x2UL);
+    KUNIT_EXPECT_EQ(test, pwm_levels(duty, 0, 0), 0UL);
+}
+
+static void myrt_pll_phase_fold_test(struct kunit *test)
+{
+    KUNIT_EXPECT_EQ(test, pll_phase_fold(0, 1000), 0);
+    KUNIT_EXPECT_EQ(test, pll_phase_fold(499, 1000), 499);
+    // (-T/2, T/2]: half a period folds to +T/2 from either side
+    KUNIT_EXPECT_EQ(test, pll_phase_fold(500, 1000), 500);
+    KUNIT_EXPECT_EQ(test, pll_phase_fold(-500, 1000), 500);
+    KUNIT_EXPECT_EQ(test, pll_phase_fold(501, 1000), -499);
+    KUNIT_EXPECT_EQ(test, pll_phase_fold(-501, 1000), 499);
+    // whole periods drop out, also far away
+    KUNIT_EXPECT_EQ(test, pll_phase_fold(3010, 1000), 10);
+    KUNIT_EXPECT_EQ(test, pll_phase_fold(-3010, 1000), -10);
+    KUNIT_EXPECT_EQ(test, pll_phase_fold(37000000123LL, 1000000), 123);
+}
+
+static void myrt_capture_period_test(struct kunit *test)
+{
+    // the first edge only arms the measurement
+    KUNIT_EXPECT_EQ(test, capture_period_ns(ns_to_ktime(5000), 0), 0ULL);
+    KUNIT_EXPECT_EQ(test, capture_period_ns(ns_to_ktime(1500), ns_to_ktime(500)), 1000ULL);
+    KUNIT_EXPECT_EQ(test, capture_period_ns(ns_to_ktime(5000000000LL), ns_to_ktime(1)),
+                    4999999999ULL);
+}
+
+static void myrt_capture_too_close_test(struct kunit *test)
+{
+    // 0 is off
+    KUNIT_EXPECT_FALSE(test, capture_too_close(ns_to_ktime(1000), ns_to_ktime(999), 0));
+    KUNIT_EXPECT_TRUE(test, capture_too_close(ns_to_ktime(1000), ns_to_ktime(500), 600));
+    // exactly min_ns apart is kept
+    KUNIT_EXPECT_FALSE(test, capture_too_close(ns_to_ktime(1100), ns_to_ktime(500), 600));
+    KUNIT_EXPECT_FALSE(test, capture_too_close(ns_to_ktime(2000), ns_to_ktime(500), 600));
+}
+
+static void myrt_pwm_slew_step_test(struct kunit *test)
+{
+    // moves by the step, and stops at the target from either side
+    KUNIT_EXPECT_EQ(test, pwm_slew_step(0, 50, 1 << 16), 1U << 16);
+    KUNIT_EXPECT_EQ(test, pwm_slew_step(50 << 16, 0, 1 << 16), 49U << 16);
+    KUNIT_EXPECT_EQ(test, pwm_slew_step((49 << 16) + 0x8000, 50, 1 << 16), 50U << 16);
+    KUNIT_EXPECT_EQ(test, pwm_slew_step((50 << 16) + 0x8000, 50, 1 << 16), 50U << 16);
+    KUNIT_EXPECT_EQ(test, pwm_slew_step(50 << 16, 50, 1 << 16), 50U << 16);
+    // a step larger than the whole range must not wrap
+    KUNIT_EXPECT_EQ(test, pwm_slew_step(0, 100, U32_MAX), 100U << 16);
+    KUNIT_EXPECT_EQ(test, pwm_slew_step(100 << 16, 0, U32_MAX), 0U);
+}
+
+static void myrt_pwm_lut_map_test(struct kunit *test)
+{
+    static const u8 lut[PWM_LUT_POINTS] = { 0, 5, 10, 20, 30, 40, 50, 60, 70, 80, 100 };
+
+    KUNIT_EXPECT_EQ(test, pwm_lut_map(lut, 0), 0);
+    KUNIT_EXPECT_EQ(test, pwm_lut_map(lut, 10), 5);
+    KUNIT_EXPECT_EQ(test, pwm_lut_map(lut, 100), 100);
+    // linear between the points, rounded to the closest
+    KUNIT_EXPECT_EQ(test, pwm_lut_map(lut, 15), 8);
+    KUNIT_EXPECT_EQ(test, pwm_lut_map(lut, 12), 6);
+    KUNIT_EXPECT_EQ(test, pwm_lut_map(lut, 95), 90);
+    // speeds outside 0..100 are clamped
+    KUNIT_EXPECT_EQ(test, pwm_lut_map(lut, -5), 0);
+    KUNIT_EXPECT_EQ(test, pwm_lut_map(lut, 150), 100);
+}
+
+// ====== Setters ======
+static struct myrt_core *myrt_test_core(struct kunit *test)
+{
+    struct myrt_core *core = kunit_kzalloc(test, sizeof(*core), GFP_KERNEL);
+
+    KUNIT_ASSERT_NOT_NULL(test, core);
+    core->n_pwm = 2;
+    myrt_core_init(core);
+    return core;
+}
+
+static void myrt_pwm_set_duty_test(struct kunit *test)
+{
+    struct myrt_core *core = myrt_test_core(test);
+
+    pwm_set_duty(core, 0, 150);
+    KUNIT_EXPECT_EQ(test, core->duty_target[0], 100);
+    KUNIT_EXPECT_EQ(test, core->duty_cycle[0], 100);
+    pwm_set_duty(core, 0, -5);
+    KUNIT_EXPECT_EQ(test, core->duty_target[0], 0);
+    KUNIT_EXPECT_EQ(test, core->duty_cycle[0], 0);
+    pwm_set_duty(core, 1, 42);
+    KUNIT_EXPECT_EQ(test, core->duty_cycle[1], 42);
+    // a slewed channel only moves its target, the steps follow per period
+    KUNIT_EXPECT_EQ(test, pwm_set_slew(core, 1, 100), 0);
+    pwm_set_duty(core, 1, 80);
+    KUNIT_EXPECT_EQ(test, core->duty_target[1], 80);
+    KUNIT_EXPECT_EQ(test, core->duty_cycle[1], 42);
+}
+
+static void myrt_pwm_set_slew_test(struct kunit *test)
+{
+    struct myrt_core *core = myrt_test_core(test);
+
+    KUNIT_EXPECT_EQ(test, pwm_set_slew(core, 2, 100), -EINVAL);
+    KUNIT_EXPECT_EQ(test, pwm_set_slew(core, 0, U32_MAX), 0);
+    KUNIT_EXPECT_EQ(test, core->slew_rate[0], (u32)PWM_SLEW_MAX);
+    KUNIT_EXPECT_EQ(test, pwm_set_slew(core, 0, 0), 0);
+    KUNIT_EXPECT_EQ(test, core->slew_mask, 0UL);
+}
+
+static void myrt_pwm_stage_test(struct kunit *test)
+{
+    struct myrt_core *core = myrt_test_core(test);
+    u32 period;
+    int duty;
+    bool inverted;
+
+    KUNIT_EXPECT_EQ(test, pwm_stage(core, 0, PWM_PERIOD_MIN_NS - 1, 50, false), -EINVAL);
+    KUNIT_EXPECT_EQ(test, pwm_stage(core, 0, PWM_PERIOD_MAX_NS + 1, 50, false), -EINVAL);
+    KUNIT_EXPECT_FALSE(test, core->next.dirty);
+
+    KUNIT_EXPECT_EQ(test, pwm_stage(core, 1, 2000000, 150, true), 0);
+    KUNIT_EXPECT_TRUE(test, core->next.dirty);
+    pwm_get_staged(core, 1, &period, &duty, &inverted);
+    KUNIT_EXPECT_EQ(test, period, 2000000U);
+    KUNIT_EXPECT_EQ(test, duty, 100);
+    KUNIT_EXPECT_TRUE(test, inverted);
+    // the other channel is staged as it runs now
+    pwm_get_staged(core, 0, &period, &duty, &inverted);
+    KUNIT_EXPECT_EQ(test, duty, core->duty_target[0]);
+    KUNIT_EXPECT_FALSE(test, inverted);
+    // nothing runs differently before the next period start
+    KUNIT_EXPECT_EQ(test, core->period_ns, (u32)PWM_PERIOD_NS);
+
+    KUNIT_EXPECT_EQ(test, pwm_stage(core, 1, 2000000, -5, false), 0);
+    pwm_get_staged(core, 1, &period, &duty, &inverted);
+    KUNIT_EXPECT_EQ(test, duty, 0);
+    KUNIT_EXPECT_FALSE(test, inverted);
+    // a plain duty write goes into the staged state as well
+    pwm_set_duty(core, 1, 30);
+    pwm_get_staged(core, 1, &period, &duty, &inverted);
+    KUNIT_EXPECT_EQ(test, duty, 30);
+}
+
+// ====== PWM timer steps ======
+#define T0  1000000LL                   // expiry of the first step run
+
+// The PWM timer of a test core, stepped by hand. It is never enqueued, so
+// hrtimer_forward moves it like in the callback; an empty line array takes
+// the pin writes, core->pwm_state still shows the levels.
+static struct myrt_core *myrt_step_core(struct kunit *test, int counter)
+{
+    struct myrt_core *core = myrt_test_core(test);
+
+    // a coarse hrtimer_forward would round every step up to its resolution
+    if (hrtimer_resolution > PWM_STEP_NS)
+        kunit_skip(test, "hrtimer resolution %u ns", hrtimer_resolution);
+    core->pwm_gpios = kunit_kzalloc(test, sizeof(*core->pwm_gpios), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, core->pwm_gpios);
+    core->counter = counter;
+    hrtimer_set_expires(&core->pwm_timer, ns_to_ktime(T0));
+    return core;
+}
+
+static s64 myrt_expires(struct myrt_core *core)
+{
+    return ktime_to_ns(hrtimer_get_expires(&core->pwm_timer));
+}
+
+static void myrt_pwm_timer_wrap_test(struct kunit *test)
+{
+    struct myrt_core *core = myrt_step_core(test, 98);
+
+    // both channels at 50: high for steps 0..49
+    KUNIT_EXPECT_EQ(test, pwm_timer_step(core, ns_to_ktime(T0)), HRTIMER_RESTART);
+    KUNIT_EXPECT_EQ(test, core->counter, 99);
+    KUNIT_EXPECT_EQ(test, core->pwm_state, 0UL);
+    KUNIT_EXPECT_EQ(test, ktime_to_ns(core->period_start), 0LL);
+    KUNIT_EXPECT_EQ(test, myrt_expires(core), T0 + PWM_STEP_NS);
+
+    pwm_timer_step(core, ns_to_ktime(T0 + PWM_STEP_NS));
+    KUNIT_EXPECT_EQ(test, core->counter, 0);
+    KUNIT_EXPECT_EQ(test, core->pwm_state, 0x3UL);
+    KUNIT_EXPECT_EQ(test, ktime_to_ns(core->period_start), T0 + PWM_STEP_NS);
+    KUNIT_EXPECT_EQ(test, myrt_expires(core), T0 + 2 * PWM_STEP_NS);
+    KUNIT_EXPECT_EQ(test, core->overruns, 0ULL);
+}
+
+static void myrt_pwm_timer_skip_test(struct kunit *test)
+{
+    struct myrt_core *core = myrt_step_core(test, 10);
+
+    // 3.5 steps late: the timer stays on its grid, 3 steps are passed over
+    pwm_timer_step(core, ns_to_ktime(T0 + 3 * PWM_STEP_NS + PWM_STEP_NS / 2));
+    KUNIT_EXPECT_EQ(test, core->counter, 11);
+    KUNIT_EXPECT_EQ(test, core->skipped, 3U);
+    KUNIT_EXPECT_EQ(test, core->overruns, 3ULL);
+    KUNIT_EXPECT_EQ(test, myrt_expires(core), T0 + 4 * PWM_STEP_NS);
+
+    pwm_timer_step(core, ns_to_ktime(T0 + 4 * PWM_STEP_NS));
+    KUNIT_EXPECT_EQ(test, core->counter, 15);
+    KUNIT_EXPECT_EQ(test, core->skipped, 0U);
+    KUNIT_EXPECT_EQ(test, core->overruns, 3ULL);
+    KUNIT_EXPECT_EQ(test, core->pwm_state, 0x3UL);
+}
+
+static void myrt_pwm_timer_latch_test(struct kunit *test)
+{
+    struct myrt_core *core = myrt_step_core(test, 97);
+
+    KUNIT_EXPECT_EQ(test, pwm_stage(core, 0, PWM_PERIOD_NS, 20, false), 0);
+    // step 98 at T0, then woken up 5 steps late
+    pwm_timer_step(core, ns_to_ktime(T0 + 5 * PWM_STEP_NS + 1));
+    KUNIT_EXPECT_EQ(test, core->counter, 98);
+    KUNIT_EXPECT_EQ(test, core->skipped, 5U);
+    KUNIT_EXPECT_TRUE(test, core->next.dirty);
+    KUNIT_EXPECT_EQ(test, core->duty_cycle[0], 50);
+
+    // steps 99 and 0 were skipped: the period still starts, when it was due
+    pwm_timer_step(core, ns_to_ktime(T0 + 6 * PWM_STEP_NS));
+    KUNIT_EXPECT_EQ(test, core->counter, 4);
+    KUNIT_EXPECT_EQ(test, ktime_to_ns(core->period_start), T0 + 2 * PWM_STEP_NS);
+    KUNIT_EXPECT_FALSE(test, core->next.dirty);
+    KUNIT_EXPECT_EQ(test, core->duty_cycle[0], 20);
+    KUNIT_EXPECT_EQ(test, core->duty_cycle[1], 50);
+}
+
+static void myrt_pwm_timer_periods_lost_test(struct kunit *test)
+{
+    struct myrt_core *core = myrt_step_core(test, 0);
+
+    // step 1 at T0, 250 steps over two period starts behind
+    pwm_timer_step(core, ns_to_ktime(T0 + 250 * PWM_STEP_NS + 1));
+    KUNIT_EXPECT_EQ(test, core->overruns, 250ULL);
+    KUNIT_EXPECT_EQ(test, core->skipped, 150U);
+    KUNIT_EXPECT_EQ(test, myrt_expires(core), T0 + 251 * PWM_STEP_NS);
+
+    // only the last period start counts
+    pwm_timer_step(core, ns_to_ktime(T0 + 251 * PWM_STEP_NS));
+    KUNIT_EXPECT_EQ(test, core->counter, 52);
+    KUNIT_EXPECT_EQ(test, ktime_to_ns(core->period_start), T0 + 199 * PWM_STEP_NS);
+}
+
+static void myrt_pwm_timer_pll_test(struct kunit *test)
+{
+    struct myrt_core *core = myrt_step_core(test, 98);
+
+    pll_set_enabled(core, true);
+    core->pll.p_corr_ns = 200;
+    core->pll.i_corr_ns = 300;
+    // the last step of the period, 3.5 steps late: the correction goes on
+    // top of the forward once, not per skipped step
+    pwm_timer_step(core, ns_to_ktime(T0 + 3 * PWM_STEP_NS + PWM_STEP_NS / 2));
+    KUNIT_EXPECT_EQ(test, core->counter, 99);
+    KUNIT_EXPECT_EQ(test, core->skipped, 3U);
+    KUNIT_EXPECT_EQ(test, myrt_expires(core), T0 + 4 * PWM_STEP_NS + 500);
+    KUNIT_EXPECT_EQ(test, core->pll.p_corr_ns, 0LL);
+    KUNIT_EXPECT_EQ(test, core->pll.i_corr_ns, 300LL);
+
+    // the stretched step moved the period start, and nothing is added
+    // anywhere else in the period
+    pwm_timer_step(core, ns_to_ktime(T0 + 4 * PWM_STEP_NS + 500));
+    KUNIT_EXPECT_EQ(test, core->counter, 3);
+    KUNIT_EXPECT_EQ(test, ktime_to_ns(core->period_start), T0 + PWM_STEP_NS + 500);
+    KUNIT_EXPECT_EQ(test, myrt_expires(core), T0 + 5 * PWM_STEP_NS + 500);
+}
+
+static struct kunit_case myrt_core_test_cases[] = {
+    KUNIT_CASE(myrt_pwm_levels_test),
+    KUNIT_CASE(myrt_pll_phase_fold_test),
+    KUNIT_CASE(myrt_capture_period_test),
+    KUNIT_CASE(myrt_capture_too_close_test),
+    KUNIT_CASE(myrt_pwm_slew_step_test),
+    KUNIT_CASE(myrt_pwm_lut_map_test),
+    KUNIT_CASE(myrt_pwm_set_duty_test),
+    KUNIT_CASE(myrt_pwm_set_slew_test),
+    KUNIT_CASE(myrt_pwm_stage_test),
+    KUNIT_CASE(myrt_pwm_timer_wrap_test),
+    KUNIT_CASE(myrt_pwm_timer_skip_test),
+    KUNIT_CASE(myrt_pwm_timer_latch_test),
+    KUNIT_CASE(myrt_pwm_timer_periods_lost_test),
+    KUNIT_CASE(myrt_pwm_timer_pll_test),
+    {}
+};
+
+static struct kunit_suite myrt_core_test_suite = {
+    .name = "myrt_core",
+    .test_cases = myrt_core_test_cases,
+};
+kunit_test_suite(myrt_core_test_suite);
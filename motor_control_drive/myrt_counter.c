@@ -0,0 +1,186 @@
+// myrt_counter.c
+// Capture channels as a counter device: one count per MEAS_IN input,
+// counting accepted rising edges. Every accepted edge pushes a
+// COUNTER_EVENT_CAPTURE on the channel, so watchers of the counter chrdev
+// get the kernel-timestamped edge with the count and period_ns components
+// they asked for, queued in the counter core.
+
+#include <linux/kernel.h>
+#include <linux/err.h>
+#include <linux/module.h>
+#include <linux/counter.h>
+#include <linux/math64.h>
+
+#include "myrt.h"
+
+struct myrt_counter {
+    struct counter_device *counter;
+    struct myrt_core *core;
+    struct counter_signal signals[MAX_CAP_CH];
+    struct counter_synapse synapses[MAX_CAP_CH];
+    struct counter_count counts[MAX_CAP_CH];
+};
+
+static const char * const myrt_signal_names[MAX_CAP_CH] = {
+    "Capture 0", "Capture 1", "Capture 2", "Capture 3",
+};
+static const char * const myrt_count_names[MAX_CAP_CH] = {
+    "Edges 0", "Edges 1", "Edges 2", "Edges 3",
+};
+
+static const enum counter_function myrt_functions[] = {
+    COUNTER_FUNCTION_INCREASE,
+};
+
+static const enum counter_synapse_action myrt_actions[] = {
+    COUNTER_SYNAPSE_ACTION_RISING_EDGE,
+};
+
+static int myrt_count_read(struct counter_device *counter,
+                           struct counter_count *count, u64 *val)
+{
+    struct myrt_counter *mc = counter_priv(counter);
+    struct capture_stats st;
+
+    capture_snapshot(&mc->core->caps[count->id], &st);
+    *val = st.edges;
+    return 0;
+}
+
+static int myrt_function_read(struct counter_device *counter,
+                              struct counter_count *count,
+                              enum counter_function *function)
+{
+    *function = COUNTER_FUNCTION_INCREASE;
+    return 0;
+}
+
+static int myrt_action_read(struct counter_device *counter,
+                            struct counter_count *count,
+                            struct counter_synapse *synapse,
+                            enum counter_synapse_action *action)
+{
+    *action = COUNTER_SYNAPSE_ACTION_RISING_EDGE;
+    return 0;
+}
+
+static int myrt_watch_validate(struct counter_device *counter,
+                               const struct counter_watch *watch)
+{
+    if (watch->event != COUNTER_EVENT_CAPTURE ||
+        watch->channel >= counter->num_counts)
+        return -EINVAL;
+    return 0;
+}
+
+static const struct counter_ops myrt_counter_ops = {
+    .count_read     = myrt_count_read,
+    .function_read  = myrt_function_read,
+    .action_read    = myrt_action_read,
+    .watch_validate = myrt_watch_validate,
+};
+
+// deprecated, period_ns has the full resolution; kept at ext id 0 for
+// existing watchers
+static int myrt_period_read(struct counter_device *counter,
+                            struct counter_count *count, u64 *val)
+{
+    struct myrt_counter *mc = counter_priv(counter);
+    struct capture_stats st;
+
+    capture_snapshot(&mc->core->caps[count->id], &st);
+    *val = div_u64(st.period_ns, NSEC_PER_USEC);
+    return 0;
+}
+
+static int myrt_period_ns_read(struct counter_device *counter,
+                               struct counter_count *count, u64 *val)
+{
+    struct myrt_counter *mc = counter_priv(counter);
+    struct capture_stats st;
+
+    capture_snapshot(&mc->core->caps[count->id], &st);
+    *val = st.period_ns;
+    return 0;
+}
+
+static int myrt_rejected_read(struct counter_device *counter,
+                              struct counter_count *count, u64 *val)
+{
+    struct myrt_counter *mc = counter_priv(counter);
+    struct capture_stats st;
+
+    capture_snapshot(&mc->core->caps[count->id], &st);
+    *val = st.rejected;
+    return 0;
+}
+
+static struct counter_comp myrt_count_ext[] = {
+    COUNTER_COMP_COUNT_U64("period_us", myrt_period_read, NULL),
+    COUNTER_COMP_COUNT_U64("rejected", myrt_rejected_read, NULL),
+    COUNTER_COMP_COUNT_U64("period_ns", myrt_period_ns_read, NULL),
+};
+
+struct myrt_counter *myrt_counter_register(struct device *parent, struct myrt_core *core)
+{
+    struct counter_device *counter;
+    struct myrt_counter *mc;
+    unsigned int ch;
+    int ret;
+
+    counter = counter_alloc(parent, sizeof(*mc));
+    if (!counter)
+        return ERR_PTR(-ENOMEM);
+    mc = counter_priv(counter);
+    mc->counter = counter;
+    mc->core = core;
+
+    for (ch = 0; ch < core->n_meas; ch++) {
+        mc->signals[ch].id = ch;
+        mc->signals[ch].name = myrt_signal_names[ch];
+
+        mc->synapses[ch].actions_list = myrt_actions;
+        mc->synapses[ch].num_actions = ARRAY_SIZE(myrt_actions);
+        mc->synapses[ch].signal = &mc->signals[ch];
+
+        mc->counts[ch].id = ch;
+        mc->counts[ch].name = myrt_count_names[ch];
+        mc->counts[ch].functions_list = myrt_functions;
+        mc->counts[ch].num_functions = ARRAY_SIZE(myrt_functions);
+        mc->counts[ch].synapses = &mc->synapses[ch];
+        mc->counts[ch].num_synapses = 1;
+        mc->counts[ch].ext = myrt_count_ext;
+        mc->counts[ch].num_ext = ARRAY_SIZE(myrt_count_ext);
+    }
+
+    counter->name = "myrt";
+    counter->parent = parent;
+    counter->ops = &myrt_counter_ops;
+    counter->signals = mc->signals;
+    counter->num_signals = core->n_meas;
+    counter->counts = mc->counts;
+    counter->num_counts = core->n_meas;
+
+    ret = counter_add(counter);
+    if (ret) {
+        counter_put(counter);
+        return ERR_PTR(ret);
+    }
+    return mc;
+}
+
+void myrt_counter_unregister(struct myrt_counter *mc)
+{
+    struct counter_device *counter = mc->counter;
+
+    counter_unregister(counter);
+    counter_put(counter);
+}
+
+// From capture_accept, hard IRQ or resample hrtimer context
+void myrt_counter_push(struct myrt_counter *mc, unsigned int ch)
+{
+    counter_push_event(mc->counter, COUNTER_EVENT_CAPTURE, ch);
+}
+
+MODULE_IMPORT_NS(COUNTER);
@@ -0,0 +1,130 @@
+// myrt_genl.c
+// Generic netlink family "myrt" (myrt_uapi.h): alarms and decimated capture
+// samples of every instance, multicast to whoever joined the group. Nothing
+// here runs on the capture or PWM paths; myrt_main.c collects from its
+// notify work and sends a batch per run, and only if someone listens.
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <net/genetlink.h>
+
+#include "myrt.h"
+#include "myrt_uapi.h"
+
+enum { MYRT_MCGRP_ALARMS, MYRT_MCGRP_SAMPLES };
+
+static const struct genl_multicast_group myrt_genl_mcgrps[] = {
+    [MYRT_MCGRP_ALARMS]  = { .name = MYRT_GENL_MCGRP_ALARMS },
+    [MYRT_MCGRP_SAMPLES] = { .name = MYRT_GENL_MCGRP_SAMPLES },
+};
+
+static struct genl_family myrt_genl_family __ro_after_init = {
+    .name       = MYRT_GENL_NAME,
+    .version    = MYRT_GENL_VERSION,
+    .maxattr    = MYRT_A_MAX,
+    .module     = THIS_MODULE,
+    .mcgrps     = myrt_genl_mcgrps,
+    .n_mcgrps   = ARRAY_SIZE(myrt_genl_mcgrps),
+};
+
+int myrt_genl_register(void)
+{
+    return genl_register_family(&myrt_genl_family);
+}
+
+void myrt_genl_unregister(void)
+{
+    genl_unregister_family(&myrt_genl_family);
+}
+
+bool myrt_genl_alarms_wanted(void)
+{
+    return genl_has_listeners(&myrt_genl_family, &init_net, MYRT_MCGRP_ALARMS);
+}
+
+bool myrt_genl_samples_wanted(void)
+{
+    return genl_has_listeners(&myrt_genl_family, &init_net, MYRT_MCGRP_SAMPLES);
+}
+
+// Message with the instance id, NULL on allocation failure
+static struct sk_buff *myrt_genl_start(int dev_id, u8 cmd, void **hdr)
+{
+    struct sk_buff *skb = genlmsg_new(NLMSG_GOODSIZE, GFP_KERNEL);
+
+    if (!skb)
+        return NULL;
+    *hdr = genlmsg_put(skb, 0, 0, &myrt_genl_family, 0, cmd);
+    if (!*hdr || nla_put_u32(skb, MYRT_A_DEV, dev_id)) {
+        nlmsg_free(skb);
+        return NULL;
+    }
+    return skb;
+}
+
+int myrt_genl_send_alarms(int dev_id, const struct myrt_genl_alarm *a,
+                          unsigned int n)
+{
+    struct sk_buff *skb;
+    struct nlattr *nest;
+    unsigned int i;
+    void *hdr;
+
+    skb = myrt_genl_start(dev_id, MYRT_CMD_ALARMS, &hdr);
+    if (!skb)
+        return -ENOMEM;
+    for (i = 0; i < n; i++) {
+        nest = nla_nest_start(skb, MYRT_A_ALARM);
+        if (!nest ||
+            nla_put_u32(skb, MYRT_AA_TYPE, a[i].type) ||
+            (a[i].type == MYRT_ALARM_STALL && nla_put_u32(skb, MYRT_AA_CH, a[i].ch)) ||
+            nla_put_u64_64bit(skb, MYRT_AA_VALUE, a[i].value, MYRT_AA_UNSPEC))
+            goto err;
+        nla_nest_end(skb, nest);
+    }
+    genlmsg_end(skb, hdr);
+    return genlmsg_multicast(&myrt_genl_family, skb, 0, MYRT_MCGRP_ALARMS, GFP_KERNEL);
+err:
+    nlmsg_free(skb);
+    return -EMSGSIZE;
+}
+
+// As many of s[] as fit in one message; returns how many were sent
+int myrt_genl_send_samples(int dev_id, const struct myrt_genl_sample *s,
+                           unsigned int n, u64 dropped)
+{
+    struct sk_buff *skb;
+    struct nlattr *nest;
+    unsigned int i;
+    void *hdr;
+    int ret;
+
+    skb = myrt_genl_start(dev_id, MYRT_CMD_SAMPLES, &hdr);
+    if (!skb)
+        return -ENOMEM;
+    if (dropped && nla_put_u64_64bit(skb, MYRT_A_DROPPED, dropped, MYRT_A_UNSPEC)) {
+        nlmsg_free(skb);
+        return -EMSGSIZE;
+    }
+    for (i = 0; i < n; i++) {
+        nest = nla_nest_start(skb, MYRT_A_SAMPLE);
+        if (!nest)
+            break;
+        if (nla_put_u64_64bit(skb, MYRT_AS_SEQ, s[i].seq, MYRT_AS_UNSPEC) ||
+            nla_put_u32(skb, MYRT_AS_CH, s[i].ch) ||
+            nla_put_u64_64bit(skb, MYRT_AS_PERIOD_NS, s[i].period_ns, MYRT_AS_UNSPEC) ||
+            nla_put_s64(skb, MYRT_AS_TS_NS, s[i].ts_ns, MYRT_AS_UNSPEC)) {
+            nla_nest_cancel(skb, nest);
+            break;
+        }
+        nla_nest_end(skb, nest);
+    }
+    if (!i) {
+        nlmsg_free(skb);
+        return -EMSGSIZE;
+    }
+    genlmsg_end(skb, hdr);
+    ret = genlmsg_multicast(&myrt_genl_family, skb, 0, MYRT_MCGRP_SAMPLES, GFP_KERNEL);
+    // ESRCH: the last listener left meanwhile, the samples are gone anyway
+    return ret && ret != -ESRCH ? ret : i;
+}
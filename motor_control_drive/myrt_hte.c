@@ -0,0 +1,84 @@
+// myrt_hte.c
+// Capture timestamps from a hardware timestamp engine. Where the firmware
+// node lists an HTE line for a capture input ("timestamps", one entry per
+// capture-gpios entry), the engine latches the edge at the pin and its
+// callback feeds the capture channel directly; the GPIO IRQ of that
+// channel is not requested. IRQ entry latency then no longer shows up in
+// the measured periods, only the engine's tick does.
+
+#include <linux/kernel.h>
+#include <linux/err.h>
+#include <linux/slab.h>
+#include <linux/hte.h>
+
+#include "myrt.h"
+
+struct myrt_hte {
+    struct hte_ts_desc desc;
+    struct capture_chan *cap;
+    u32 err_ns;             // one tick of the engine clock
+};
+
+// From the HTE provider's interrupt
+static enum hte_return myrt_hte_cb(struct hte_ts_data *ts, void *data)
+{
+    struct myrt_hte *mh = data;
+
+    capture_push(mh->cap, ns_to_ktime(ts->tsc), CAPTURE_TS_HTE, mh->err_ns);
+    return HTE_CB_HANDLED;
+}
+
+struct myrt_hte *myrt_hte_request(struct device *dev, struct capture_chan *cap,
+                                  struct gpio_desc *gpio)
+{
+    struct hte_clk_info ci;
+    struct myrt_hte *mh;
+    int ret;
+
+    mh = kzalloc(sizeof(*mh), GFP_KERNEL);
+    if (!mh)
+        return ERR_PTR(-ENOMEM);
+    mh->cap = cap;
+
+    ret = hte_init_line_attr(&mh->desc, 0, HTE_RISING_EDGE_TS, NULL, gpio);
+    if (ret)
+        goto err_free;
+    ret = hte_ts_get(dev, &mh->desc, cap->ch);
+    if (ret)
+        goto err_free;
+
+    // the timestamps are compared against ktime_get() (PLL, PWM phase)
+    ret = hte_get_clk_src_info(&mh->desc, &ci);
+    if (ret)
+        goto err_put;
+    if (ci.type != CLOCK_MONOTONIC) {
+        dev_warn(dev, "HTE clock of capture %u is not CLOCK_MONOTONIC\n", cap->ch);
+        ret = -EINVAL;
+        goto err_put;
+    }
+    mh->err_ns = ci.hz ? DIV_ROUND_UP(NSEC_PER_SEC, ci.hz) : 0;
+
+    ret = hte_request_ts_ns(&mh->desc, myrt_hte_cb, NULL, mh);
+    if (ret)
+        goto err_put;
+    dev_info(dev, "capture %u: HTE timestamps, %u ns tick\n", cap->ch, mh->err_ns);
+    return mh;
+
+err_put:
+    hte_ts_put(&mh->desc);
+err_free:
+    kfree(mh);
+    // no HTE line for this input, or one that cannot be used: software
+    // timestamps, unless the provider just is not there yet
+    if (ret == -EPROBE_DEFER)
+        return ERR_PTR(ret);
+    if (ret != -ENOENT)
+        dev_warn(dev, "capture %u: no HTE (%d), software timestamps\n", cap->ch, ret);
+    return NULL;
+}
+
+void myrt_hte_release(struct myrt_hte *mh)
+{
+    hte_ts_put(&mh->desc);
+    kfree(mh);
+}
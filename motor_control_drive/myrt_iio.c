@@ -0,0 +1,126 @@
+// myrt_iio.c
+// Capture edges as an IIO device with a kfifo buffer. Each accepted edge is
+// one scan: the capture channel it came from, its period in ns and the
+// edge time, converted to the device's IIO timestamp clock. iio_readdev and
+// libiio read them from /dev/iio:deviceN at the full edge rate.
+
+#include <linux/kernel.h>
+#include <linux/err.h>
+#include <linux/spinlock.h>
+#include <linux/math64.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/kfifo_buf.h>
+
+#include "myrt.h"
+
+struct myrt_iio {
+    struct iio_dev *indio_dev;
+    struct myrt_core *core;
+    spinlock_t lock;            // edges of different channels push concurrently
+    struct {
+        u32 index;              // capture channel
+        u64 period_ns __aligned(8);
+        s64 timestamp __aligned(8);
+    } scan;
+};
+
+enum { MYRT_IIO_INDEX, MYRT_IIO_PERIOD, MYRT_IIO_TIMESTAMP };
+
+static const struct iio_chan_spec myrt_iio_channels[] = {
+    {
+        .type = IIO_INDEX,
+        .indexed = 1,
+        .channel = 0,
+        .scan_index = MYRT_IIO_INDEX,
+        .scan_type = { .sign = 'u', .realbits = 32, .storagebits = 32,
+                       .endianness = IIO_CPU },
+    },
+    {
+        .type = IIO_COUNT,
+        .indexed = 1,
+        .channel = 0,
+        .extend_name = "period",
+        .info_mask_separate = BIT(IIO_CHAN_INFO_SCALE),
+        .scan_index = MYRT_IIO_PERIOD,
+        .scan_type = { .sign = 'u', .realbits = 64, .storagebits = 64,
+                       .endianness = IIO_CPU },
+    },
+    IIO_CHAN_SOFT_TIMESTAMP(MYRT_IIO_TIMESTAMP),
+};
+
+static int myrt_iio_read_raw(struct iio_dev *indio_dev,
+                             struct iio_chan_spec const *chan,
+                             int *val, int *val2, long mask)
+{
+    if (mask != IIO_CHAN_INFO_SCALE || chan->scan_index != MYRT_IIO_PERIOD)
+        return -EINVAL;
+    // period_ns * scale = seconds
+    *val = 0;
+    *val2 = 1;
+    return IIO_VAL_INT_PLUS_NANO;
+}
+
+static const struct iio_info myrt_iio_info = {
+    .read_raw = myrt_iio_read_raw,
+};
+
+struct myrt_iio *myrt_iio_register(struct device *parent, struct myrt_core *core)
+{
+    struct iio_dev *indio_dev;
+    struct myrt_iio *mi;
+    int ret;
+
+    indio_dev = iio_device_alloc(parent, sizeof(*mi));
+    if (!indio_dev)
+        return ERR_PTR(-ENOMEM);
+    mi = iio_priv(indio_dev);
+    mi->indio_dev = indio_dev;
+    mi->core = core;
+    spin_lock_init(&mi->lock);
+
+    indio_dev->name = "myrt";
+    indio_dev->info = &myrt_iio_info;
+    indio_dev->channels = myrt_iio_channels;
+    indio_dev->num_channels = ARRAY_SIZE(myrt_iio_channels);
+
+    // the kfifo is only offered as devres; the parent's devres is released
+    // with the myrt device, after the IIO device has dropped its reference
+    ret = devm_iio_kfifo_buffer_setup(parent, indio_dev, NULL);
+    if (ret)
+        goto err_free_dev;
+
+    ret = iio_device_register(indio_dev);
+    if (ret)
+        goto err_free_dev;
+    return mi;
+
+err_free_dev:
+    iio_device_free(indio_dev);
+    return ERR_PTR(ret);
+}
+
+void myrt_iio_unregister(struct myrt_iio *mi)
+{
+    iio_device_unregister(mi->indio_dev);
+    iio_device_free(mi->indio_dev);
+}
+
+// From capture_accept, hard IRQ or resample hrtimer context
+void myrt_iio_push(struct myrt_iio *mi, struct capture_chan *cap, ktime_t edge)
+{
+    struct iio_dev *indio_dev = mi->indio_dev;
+    unsigned long flags;
+    s64 ts;
+
+    if (!iio_buffer_enabled(indio_dev))
+        return;
+    // the edge on the clock selected in current_timestamp_clock
+    ts = ktime_to_ns(edge) + iio_get_time_ns(indio_dev) - ktime_get_ns();
+
+    spin_lock_irqsave(&mi->lock, flags);
+    mi->scan.index = cap->ch;
+    mi->scan.period_ns = cap->st.period_ns;
+    iio_push_to_buffers_with_timestamp(indio_dev, &mi->scan, ts);
+    spin_unlock_irqrestore(&mi->lock, flags);
+}
@@ -0,0 +1,2516 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/device.h>
+#include <linux/platform_device.h>
+#include <linux/mod_devicetable.h>
+#include <linux/property.h>
+#include <linux/idr.h>
+#include <linux/uaccess.h>
+#include <linux/cdev.h>
+#include <linux/ktime.h>
+#include <linux/string.h>
+#include <linux/ctype.h>
+#include <linux/printk.h>
+#include <linux/bitops.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/kfifo.h>
+#include <linux/spinlock.h>
+#include <linux/math64.h>
+#include <linux/wait.h>
+#include <linux/rwsem.h>
+#include <linux/poll.h>
+#include <linux/irq_work.h>
+#include <linux/kthread.h>
+#include <linux/cpumask.h>
+#include <linux/workqueue.h>
+#include <uapi/linux/sched/types.h>
+
+#include "myrt.h"
+#include "myrt_uapi.h"
+#include <linux/gpio/machine.h>    // lookup table of the pin instance
+
+#if USE_GPIOD == 0
+#error "the platform driver gets its lines from firmware, through gpiod"
+#endif
+
+#define DEVICE_NAME "myrt"
+#define CLASS_NAME  "myrtclass"
+#define MYRT_MAX_DEVS 16         // minors, one per bound instance
+
+// GPIO config of the instance built from the module parameters
+#define GPIO_CHIP   "pinctrl-bcm2711"
+#define GPIO_PWM    12   // output PWM (channel 0)
+#define GPIO_MEAS   16   // input to measure rising edges (channel 0)
+
+static bool pin_instance = true;
+module_param(pin_instance, bool, 0444);
+MODULE_PARM_DESC(pin_instance, "create myrt.0 from the pin parameters below, for boards without a firmware node (default on)");
+
+static char *gpio_chip = GPIO_CHIP;
+module_param(gpio_chip, charp, 0444);
+MODULE_PARM_DESC(gpio_chip, "label of the gpiochip the pin numbers refer to");
+
+static int pwm_gpios[MAX_PWM_CH] = { GPIO_PWM };
+static int n_pwm = 1;
+module_param_array(pwm_gpios, int, &n_pwm, 0444);
+MODULE_PARM_DESC(pwm_gpios, "PWM output pins, one channel per pin (default 12)");
+
+static int meas_gpios[MAX_CAP_CH] = { GPIO_MEAS };
+static int n_meas = 1;
+module_param_array_named(meas_gpio, meas_gpios, int, &n_meas, 0444);
+MODULE_PARM_DESC(meas_gpio, "input pins whose rising edges are measured, one capture channel each (default 16)");
+
+static uint deglitch_ns = 0;
+module_param(deglitch_ns, uint, 0444);
+MODULE_PARM_DESC(deglitch_ns, "initial minimum edge interval of every capture channel, unless the firmware node has deglitch-ns (0 = off)");
+
+static int step_gpio = -1;
+module_param(step_gpio, int, 0444);
+MODULE_PARM_DESC(step_gpio, "stepper STEP output pin (-1 = no stepper)");
+
+static int dir_gpio = -1;
+module_param(dir_gpio, int, 0444);
+MODULE_PARM_DESC(dir_gpio, "stepper DIR output pin");
+
+#define N_HALL      3
+#define N_PHASE_OUT 6    // UH, UL, VH, VL, WH, WL
+
+static int hall_gpios[N_HALL];
+static int n_hall = 0;
+module_param_array(hall_gpios, int, &n_hall, 0444);
+MODULE_PARM_DESC(hall_gpios, "BLDC hall sensor inputs H1,H2,H3 (none = no BLDC)");
+
+static int bldc_gpios[N_PHASE_OUT];
+static int n_bldc = 0;
+module_param_array(bldc_gpios, int, &n_bldc, 0444);
+MODULE_PARM_DESC(bldc_gpios, "BLDC bridge outputs UH,UL,VH,VL,WH,WL");
+
+static int estop_gpio = -1;
+module_param(estop_gpio, int, 0444);
+MODULE_PARM_DESC(estop_gpio, "emergency stop input, high = stop (-1 = none)");
+
+#define MAX_SERVO   16
+
+static int servo_gpios[MAX_SERVO];
+static int n_servo = 0;
+module_param_array(servo_gpios, int, &n_servo, 0444);
+MODULE_PARM_DESC(servo_gpios, "RC servo outputs, 50 Hz frames (none = no servos)");
+
+// where the capture path runs after the hard IRQ has timestamped the edge
+static char *defer = "none";
+module_param(defer, charp, 0444);
+MODULE_PARM_DESC(defer, "capture processing: none (in the hard IRQ), irq_work or kthread");
+
+static int defer_cpu = 0;
+module_param(defer_cpu, int, 0444);
+MODULE_PARM_DESC(defer_cpu, "CPU of the deferred capture work (irq_work: always, kthread: -1 = any)");
+
+static int defer_prio = 50;
+module_param(defer_prio, int, 0444);
+MODULE_PARM_DESC(defer_prio, "SCHED_FIFO priority of the kthread (1-99)");
+
+// generic netlink notifications, see myrt_notify_work
+static uint notify_ms = 100;
+module_param(notify_ms, uint, 0444);
+MODULE_PARM_DESC(notify_ms, "interval of the netlink alarm checks and sample batches");
+
+static uint notify_decimate = 10;
+module_param(notify_decimate, uint, 0644);
+MODULE_PARM_DESC(notify_decimate, "multicast every n-th capture edge to the samples group");
+
+static uint stall_ms = 500;
+module_param(stall_ms, uint, 0644);
+MODULE_PARM_DESC(stall_ms, "no edge on a capture channel that had some for this long raises a stall alarm (0 = off)");
+
+// phase lock of the PWM period to the MEAS_IN edges, picked up by "pll on"
+static int pll_kp_shift = 1;
+module_param(pll_kp_shift, int, 0644);
+MODULE_PARM_DESC(pll_kp_shift, "PLL proportional gain, 1/2^n of the phase error");
+
+static int pll_ki_shift = 4;
+module_param(pll_ki_shift, int, 0644);
+MODULE_PARM_DESC(pll_ki_shift, "PLL integral gain, 1/2^n of the summed phase error");
+
+static int pll_lock_ns = 5000;
+module_param(pll_lock_ns, int, 0644);
+MODULE_PARM_DESC(pll_lock_ns, "phase error window counted as locked");
+
+// ====== Per-instance state ======
+#define MOVE_QUEUE_LEN  16
+
+enum step_ramp_type { RAMP_TRAP, RAMP_SCURVE };
+
+struct stepper_move {
+    s32 target;     // absolute position, steps
+    u32 speed;      // cruise speed, steps/s
+};
+
+struct myrt_stepper {
+    struct gpio_desc *step_gpio;
+    struct gpio_desc *dir_gpio;
+    DECLARE_KFIFO(move_queue, struct stepper_move, MOVE_QUEUE_LEN);
+    spinlock_t lock;    // move_queue and busy
+    struct hrtimer timer;
+    u32 accel;          // steps/s^2
+    u32 jerk;           // steps/s^3, S-curve only
+    enum step_ramp_type ramp;
+
+    s32 position;       // steps, counted on each rising edge
+    int dir;            // +1 / -1
+    u32 remaining;      // steps still to be issued in the current move
+    u32 ramp_steps;     // steps spent accelerating, the decel ramp mirrors it
+    u64 interval;       // ns until the next rising edge
+    u64 c, c_min;       // trapezoid: step interval and cruise interval, ns << 8
+    u64 v, v_max, a;    // S-curve: speed (steps/s << 8), accel (steps/s^2 << 8)
+    bool pulse_high;
+    bool busy;          // timer is running a move
+};
+
+struct myrt_bldc {
+    struct gpio_descs *halls;
+    struct gpio_descs *bridge;
+    int irqs[N_HALL];
+    spinlock_t lock;
+    bool enabled;
+    bool reverse;
+    int duty;               // percent, chops the high side
+    bool pwm_on;            // PWM level of the current step
+    int step;               // -1 = off or hall fault
+    unsigned long high;     // switches of the current step
+    unsigned long low;
+    unsigned long out;      // levels currently on the bridge outputs
+    u64 commutations;
+    u64 faults;             // invalid hall codes seen while enabled
+    s64 lat_max_ns;         // IRQ entry to bridge written, worst case
+};
+
+struct servo_event {
+    u32 t_us;               // offset into the frame
+    unsigned long set;      // channels going high
+    unsigned long clear;    // channels going low
+};
+
+struct myrt_servo {
+    struct gpio_descs *gpios;
+    unsigned int n;
+    spinlock_t lock;            // pending
+    struct hrtimer timer;
+    u32 pending[MAX_SERVO];     // widths for the next frame, us, 0 = off
+    u32 width[MAX_SERVO];       // widths latched for the current frame
+    struct servo_event ev[2 * MAX_SERVO + 1];
+    unsigned int n_ev;
+    unsigned int next;          // next event to apply
+    ktime_t frame_start;
+    unsigned long levels;
+};
+
+#define MYRT_RING_LEN   1024     // capture records, power of two
+
+// clock base of the stream timestamps, per instance ("clock <name>")
+enum myrt_clock {
+    MYRT_CLOCK_MONOTONIC,
+    MYRT_CLOCK_MONOTONIC_RAW,
+    MYRT_CLOCK_BOOTTIME,
+    MYRT_CLOCK_TAI,
+};
+
+static const char * const myrt_clock_names[] = {
+    [MYRT_CLOCK_MONOTONIC]      = "monotonic",
+    [MYRT_CLOCK_MONOTONIC_RAW]  = "monotonic_raw",
+    [MYRT_CLOCK_BOOTTIME]       = "boottime",
+    [MYRT_CLOCK_TAI]            = "tai",
+};
+
+struct myrt_sample {
+    u64 seq;                // position in the instance's edge stream
+    u64 period_ns;
+    s64 ts_ns;              // accepted edge, in the clock base of ts_clock
+    u32 ch;
+    u32 ts_err_ns;          // estimated error of ts_ns
+    u8 ts_src;              // enum capture_ts_src
+    u8 ts_clock;            // enum myrt_clock
+};
+
+// Written once per accepted edge, read by every open file with its own
+// cursor. reserve runs ahead of head while a record is being written, so a
+// reader can tell a slot that was overwritten under it.
+struct myrt_ring {
+    raw_spinlock_t lock;        // producers, capture IRQs on several CPUs
+    unsigned long reserve;      // slots handed to producers
+    unsigned long head;         // slots completely written
+    u64 seq;
+    wait_queue_head_t wq;
+    struct myrt_sample *buf;
+};
+
+// private_data of every open /dev/myrt<id>
+struct myrt_reader {
+    struct myrt_dev *md;
+    unsigned long cursor;       // next slot to read
+    u64 dropped;                // overwritten before this file read them
+    int clock;                  // clock base of the last record read, -1 = none
+};
+
+enum myrt_defer_mode { DEFER_NONE, DEFER_IRQ_WORK, DEFER_KTHREAD };
+
+static const char * const myrt_defer_names[] = {
+    [DEFER_NONE]        = "none",
+    [DEFER_IRQ_WORK]    = "irq_work",
+    [DEFER_KTHREAD]     = "kthread",
+};
+
+// the capture path behind the hard IRQ, see myrt_defer_start
+struct myrt_defer {
+    int mode;                       // enum myrt_defer_mode
+    int cpu;
+    struct irq_work iw;
+    struct kthread_worker *worker;
+    struct kthread_work work;
+};
+
+#define MYRT_NOTIFY_BATCH   64      // samples per netlink message
+
+// state of the netlink notify work, see myrt_notify_work
+struct myrt_notify {
+    struct delayed_work work;
+    unsigned long cursor;           // in the capture ring, like an open file
+    u64 dropped;                    // samples lost and not yet reported
+    u64 overruns, misses, estops;   // last seen
+    bool locked;
+    u64 edges[MAX_CAP_CH];
+    unsigned long stalled;          // channels reported stalled
+    struct myrt_genl_sample batch[MYRT_NOTIFY_BATCH];
+};
+
+// BPF control law of the instance, see myrt_ctl_edge
+struct myrt_ctl {
+    int in_ch;                      // capture channel, -1 = off
+    unsigned int out_ch;
+    u64 setpoint;
+    u64 calls;
+    u32 max_ns;                     // longest law call
+};
+
+// one per bound platform device, /dev/myrt<id>. Freed with cdev_dev, so it
+// outlives the binding as long as a file is open; see myrt_remove.
+struct myrt_dev {
+    struct device *dev;             // the platform device
+    struct device cdev_dev;         // /sys/class/myrtclass/myrt<id>
+    struct cdev cdev;
+    int id;
+    struct rw_semaphore gone_lock;  // file operations against myrt_remove
+    bool gone;                      // unbound, the files only get ENODEV
+
+    struct myrt_core core;
+    struct myrt_stepper stp;
+    struct myrt_bldc bldc;
+    struct myrt_servo servo;
+    struct myrt_ring ring;
+    struct myrt_defer defer;
+    struct kthread_worker *out_worker;  // NULL unless the PWM lines can sleep
+    struct kthread_work out_work;
+    bool meas_cansleep;             // capture lines can sleep: no resampling
+    struct myrt_notify notify;
+    struct myrt_ctl ctl;
+    int clock;                      // enum myrt_clock of the ring timestamps
+    int align_clock;                // enum myrt_clock the PWM periods align to
+
+    struct myrt_pwm *pwm;           // NULL without CONFIG_PWM
+    struct myrt_counter *counter;   // NULL without CONFIG_COUNTER
+    struct myrt_iio *iio;           // NULL without CONFIG_IIO_KFIFO_BUF
+    struct myrt_hte *hte[MAX_CAP_CH];   // NULL = software timestamps
+
+    struct gpio_desc *estop_gpio;   // NULL = no emergency stop input
+    int estop_irq;                  // 0 until requested
+};
+
+// shared by all instances
+static dev_t myrt_devt;
+static struct class*  myrt_class  = NULL;
+static DEFINE_IDA(myrt_ida);
+static struct gpiod_lookup_table *myrt_lookup;
+static struct platform_device *myrt_pin_pdev;
+
+// ====== Six-step BLDC commutation ======
+// The hall IRQ looks up the commutation step and switches the bridge in the
+// handler itself. The high side of the driven phase is chopped by the PWM
+// engine (bldc->pwm_on follows pwm_timer_callback), the low side stays on.
+#define PH_H(p) BIT(2 * (p))        // high-side switch of phase p
+#define PH_L(p) BIT(2 * (p) + 1)    // low-side switch of phase p
+enum { PH_U, PH_V, PH_W };
+
+// commutation step -> { phase driven high, phase pulled low }
+static const u8 bldc_steps[6][2] = {
+    { PH_U, PH_V }, { PH_U, PH_W }, { PH_V, PH_W },
+    { PH_V, PH_U }, { PH_W, PH_U }, { PH_W, PH_V },
+};
+// hall code H3H2H1 -> commutation step, -1 for the invalid 000 and 111
+static const s8 hall_to_step[8] = { -1, 0, 2, 1, 4, 5, 3, -1 };
+
+static bool bldc_present(struct myrt_dev *md)
+{
+    return md->bldc.halls && md->bldc.bridge;
+}
+
+// Write the bridge outputs. Called with bldc->lock held.
+static void bldc_apply(struct myrt_bldc *bldc)
+{
+    unsigned long out = bldc->low | (bldc->pwm_on ? bldc->high : 0);
+
+    if (out == bldc->out)
+        return;
+    gpiod_set_array_value(bldc->bridge->ndescs, bldc->bridge->desc,
+                          bldc->bridge->info, &out);
+    bldc->out = out;
+}
+
+// Read the halls and switch to the matching step. Called with bldc->lock held.
+static void bldc_commutate(struct myrt_bldc *bldc)
+{
+    unsigned long hall = 0;
+    int step;
+
+    gpiod_get_array_value(bldc->halls->ndescs, bldc->halls->desc,
+                          bldc->halls->info, &hall);
+    step = hall_to_step[hall & 7];
+    if (!bldc->enabled || step < 0) {
+        if (bldc->enabled)
+            bldc->faults++;
+        bldc->step = -1;
+        bldc->high = bldc->low = 0;
+    } else {
+        // driving the opposite pair of phases turns the torque around
+        if (bldc->reverse)
+            step = (step + 3) % 6;
+        if (step != bldc->step)
+            bldc->commutations++;
+        bldc->step = step;
+        bldc->high = PH_H(bldc_steps[step][0]);
+        bldc->low  = PH_L(bldc_steps[step][1]);
+    }
+    bldc_apply(bldc);
+}
+
+static irqreturn_t hall_irq_handler(int irq, void *dev_id)
+{
+    struct myrt_bldc *bldc = dev_id;
+    ktime_t now = ktime_get();
+    s64 lat;
+
+    spin_lock(&bldc->lock);
+    bldc_commutate(bldc);
+    lat = ktime_to_ns(ktime_sub(ktime_get(), now));
+    if (lat > bldc->lat_max_ns)
+        bldc->lat_max_ns = lat;
+    spin_unlock(&bldc->lock);
+    return IRQ_HANDLED;
+}
+
+// PWM step for the bridge, the core's pwm_step_hook
+static void bldc_pwm_step(struct myrt_core *core, int counter)
+{
+    struct myrt_bldc *bldc = &container_of(core, struct myrt_dev, core)->bldc;
+    unsigned long flags;
+    bool on = counter < READ_ONCE(bldc->duty);
+
+    if (!READ_ONCE(bldc->enabled) || on == bldc->pwm_on)
+        return;
+    spin_lock_irqsave(&bldc->lock, flags);
+    bldc->pwm_on = on;
+    bldc_apply(bldc);
+    spin_unlock_irqrestore(&bldc->lock, flags);
+}
+
+// ====== RC servo frames ======
+// One timer serves all servos. Channel n's pulse starts n * SERVO_STAGGER_US
+// into the 20 ms frame, so the rising edges never pile up. At each frame
+// start the pending widths are latched and turned into a sorted list of
+// edge times; the timer then only fires at those times, and edges that
+// fall on the same microsecond are written together.
+#define SERVO_FRAME_US    20000
+#define SERVO_MIN_US      500
+#define SERVO_MAX_US      2500
+// the last channel's longest pulse still ends inside the frame
+#define SERVO_STAGGER_US  ((SERVO_FRAME_US - SERVO_MAX_US) / MAX_SERVO)
+
+static bool servo_present(struct myrt_dev *md)
+{
+    return md->servo.gpios != NULL;
+}
+
+static void servo_apply_levels(struct myrt_servo *servo, unsigned long levels)
+{
+    gpiod_set_array_value(servo->gpios->ndescs, servo->gpios->desc,
+                          servo->gpios->info, &levels);
+    servo->levels = levels;
+}
+
+// Add an edge at t_us, merging it with an event already at that time.
+static void servo_add_event(struct myrt_servo *servo, u32 t_us,
+                            unsigned long set, unsigned long clear)
+{
+    unsigned int i = servo->n_ev;
+
+    while (i > 0 && servo->ev[i - 1].t_us > t_us)
+        i--;
+    if (i > 0 && servo->ev[i - 1].t_us == t_us) {
+        servo->ev[i - 1].set |= set;
+        servo->ev[i - 1].clear |= clear;
+        return;
+    }
+    memmove(&servo->ev[i + 1], &servo->ev[i],
+            (servo->n_ev - i) * sizeof(servo->ev[0]));
+    servo->ev[i] = (struct servo_event){ .t_us = t_us, .set = set, .clear = clear };
+    servo->n_ev++;
+}
+
+// Latch the widths and build this frame's edge list. Event 0 is always the
+// frame start, so the timer comes back here once per frame.
+static void servo_plan_frame(struct myrt_servo *servo)
+{
+    unsigned int ch;
+
+    spin_lock(&servo->lock);
+    memcpy(servo->width, servo->pending, sizeof(servo->width));
+    spin_unlock(&servo->lock);
+
+    servo->n_ev = 1;
+    servo->ev[0] = (struct servo_event){ 0 };
+    for (ch = 0; ch < servo->n; ch++) {
+        u32 start = ch * SERVO_STAGGER_US;
+
+        if (!servo->width[ch])
+            continue;
+        servo_add_event(servo, start, BIT(ch), 0);
+        servo_add_event(servo, start + servo->width[ch], 0, BIT(ch));
+    }
+}
+
+static enum hrtimer_restart servo_timer_callback(struct hrtimer *timer)
+{
+    struct myrt_servo *servo = container_of(timer, struct myrt_servo, timer);
+    struct myrt_dev *md = container_of(servo, struct myrt_dev, servo);
+    struct servo_event *ev;
+
+    // stopped: a pulse in progress ends here, every line goes low
+    if (READ_ONCE(md->core.estopped)) {
+        servo_apply_levels(servo, 0);
+        return HRTIMER_NORESTART;
+    }
+    if (servo->next == 0)
+        servo_plan_frame(servo);
+
+    ev = &servo->ev[servo->next];
+    if (ev->set || ev->clear)
+        servo_apply_levels(servo, (servo->levels | ev->set) & ~ev->clear);
+
+    if (++servo->next < servo->n_ev) {
+        hrtimer_set_expires(timer, ktime_add_us(servo->frame_start,
+                                                servo->ev[servo->next].t_us));
+    } else {
+        servo->next = 0;
+        servo->frame_start = ktime_add_us(servo->frame_start, SERVO_FRAME_US);
+        hrtimer_set_expires(timer, servo->frame_start);
+    }
+    return HRTIMER_RESTART;
+}
+
+// Frames start one frame from now, with every channel off until commanded.
+// Not while stopped, "arm" starts them then.
+static void servo_start(struct myrt_dev *md)
+{
+    struct myrt_servo *servo = &md->servo;
+    unsigned long flags;
+
+    if (!servo_present(md) || READ_ONCE(md->core.estopped))
+        return;
+    spin_lock_irqsave(&servo->lock, flags);
+    memset(servo->pending, 0, sizeof(servo->pending));
+    spin_unlock_irqrestore(&servo->lock, flags);
+    servo->next = 0;
+    servo->frame_start = ktime_add_us(ktime_get(), SERVO_FRAME_US);
+    hrtimer_start(&servo->timer, servo->frame_start, HRTIMER_MODE_ABS);
+}
+
+// ====== Stepper step/dir generator ======
+// Each step is two timer events: the rising edge (position counts here) and
+// the falling edge STEP_PULSE_NS later, after which the timer waits out the
+// rest of the step interval. The interval for the next step is computed
+// incrementally on every step from the selected ramp, so no profile tables
+// are needed and moves of any length work.
+#define STEP_PULSE_NS   2000     // STEP high time
+#define DIR_SETUP_NS    5000     // DIR settle time before the first step
+#define STEP_MIN_SPEED  16       // steps/s, speed the S-curve starts/stops at
+#define STEP_MAX_SPEED  (NSEC_PER_SEC / (2 * STEP_PULSE_NS))
+// the S-curve works in u64: a * a and dv * 2 * jerk * 256 stay below 2^64
+#define STEP_MAX_ACCEL  10000000    // steps/s^2
+#define STEP_MAX_JERK   100000000   // steps/s^3
+
+static void stepper_start_ramp(struct myrt_stepper *stp, u32 speed)
+{
+    // Austin, "Generate stepper-motor speed profiles in real time":
+    // c0 = 0.676 * sqrt(2 / accel), then c_n = c_n-1 - 2 c_n-1 / (4n + 1)
+    u64 c0 = int_sqrt64(div_u64(2ULL * NSEC_PER_SEC * NSEC_PER_SEC, stp->accel));
+
+    stp->c = div_u64((c0 * 676) << 8, 1000);
+    stp->c_min = div_u64((u64)NSEC_PER_SEC << 8, speed);
+    if (stp->c < stp->c_min)
+        stp->c = stp->c_min;
+    stp->v = (u64)STEP_MIN_SPEED << 8;
+    stp->v_max = (u64)speed << 8;
+    stp->a = 0;
+    stp->ramp_steps = 0;
+}
+
+// Interval until the step after the one just issued. Deceleration starts
+// once the steps left no longer cover the ramp it took to get up to speed.
+static u64 stepper_next_interval(struct myrt_stepper *stp)
+{
+    bool decel = stp->remaining <= stp->ramp_steps;
+    u64 interval;
+
+    if (stp->ramp == RAMP_TRAP) {
+        if (decel) {
+            if (stp->remaining)
+                stp->c += div64_u64(2 * stp->c, 4 * (u64)stp->remaining - 1);
+        } else if (stp->c > stp->c_min) {
+            if (stp->ramp_steps)
+                stp->c -= div64_u64(2 * stp->c, 4 * (u64)stp->ramp_steps + 1);
+            if (stp->c < stp->c_min)
+                stp->c = stp->c_min;
+            stp->ramp_steps++;
+        }
+        interval = stp->c >> 8;
+    } else {
+        // jerk-limited: accel ramps up by jerk * dt and eases off again once
+        // the speed left to gain is what the accel takes to wind down
+        u64 dt = div64_u64((u64)NSEC_PER_SEC << 8, stp->v);
+        u64 target = decel ? (u64)STEP_MIN_SPEED << 8 : stp->v_max;
+        u64 dv = target > stp->v ? target - stp->v : stp->v - target;
+        u64 da = div_u64(((u64)stp->jerk * dt) << 8, NSEC_PER_SEC);
+        u64 dv_step;
+
+        if (dv * 2 * stp->jerk * 256 <= stp->a * stp->a)
+            stp->a = stp->a > 2 * da ? stp->a - da : da;
+        else
+            stp->a = min(stp->a + da, (u64)stp->accel << 8);
+
+        dv_step = div_u64(stp->a * dt, NSEC_PER_SEC);
+        if (dv_step >= dv)
+            stp->v = target;
+        else if (target > stp->v)
+            stp->v += dv_step;
+        else
+            stp->v -= dv_step;
+
+        if (!decel && stp->v < stp->v_max)
+            stp->ramp_steps++;
+        interval = div64_u64((u64)NSEC_PER_SEC << 8, stp->v);
+    }
+    return max_t(u64, interval, 2 * STEP_PULSE_NS);
+}
+
+// Pop the next move that actually goes somewhere. Called with stp->lock held.
+static bool stepper_next_move(struct myrt_stepper *stp)
+{
+    struct stepper_move mv;
+
+    while (kfifo_get(&stp->move_queue, &mv)) {
+        if (mv.target == stp->position)
+            continue;
+        stp->dir = mv.target > stp->position ? 1 : -1;
+        stp->remaining = abs(mv.target - stp->position);
+        gpiod_set_value(stp->dir_gpio, stp->dir < 0);
+        stepper_start_ramp(stp, mv.speed);
+        return true;
+    }
+    return false;
+}
+
+// Drop the current move and the queued ones, STEP low. The position stays
+// at the steps actually issued.
+static void stepper_halt(struct myrt_stepper *stp)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&stp->lock, flags);
+    kfifo_reset(&stp->move_queue);
+    stp->remaining = 0;
+    stp->pulse_high = false;
+    stp->busy = false;
+    spin_unlock_irqrestore(&stp->lock, flags);
+    gpiod_set_value(stp->step_gpio, 0);
+}
+
+static enum hrtimer_restart step_timer_callback(struct hrtimer *timer)
+{
+    struct myrt_stepper *stp = container_of(timer, struct myrt_stepper, timer);
+    struct myrt_dev *md = container_of(stp, struct myrt_dev, stp);
+    unsigned long flags;
+    bool more;
+
+    if (READ_ONCE(md->core.estopped)) {
+        stepper_halt(stp);
+        return HRTIMER_NORESTART;
+    }
+    if (!stp->pulse_high) {
+        gpiod_set_value(stp->step_gpio, 1);
+        stp->pulse_high = true;
+        stp->position += stp->dir;
+        stp->remaining--;
+        stp->interval = stepper_next_interval(stp);
+        hrtimer_add_expires_ns(timer, STEP_PULSE_NS);
+        return HRTIMER_RESTART;
+    }
+
+    gpiod_set_value(stp->step_gpio, 0);
+    stp->pulse_high = false;
+    if (stp->remaining) {
+        hrtimer_add_expires_ns(timer, stp->interval - STEP_PULSE_NS);
+        return HRTIMER_RESTART;
+    }
+
+    // move done, chain the next queued one after the DIR setup time
+    spin_lock_irqsave(&stp->lock, flags);
+    more = stp->busy = stepper_next_move(stp);
+    spin_unlock_irqrestore(&stp->lock, flags);
+    if (!more)
+        return HRTIMER_NORESTART;
+    hrtimer_add_expires_ns(timer, DIR_SETUP_NS);
+    return HRTIMER_RESTART;
+}
+
+static int stepper_queue_move(struct myrt_stepper *stp, s32 target, u32 speed)
+{
+    struct myrt_dev *md = container_of(stp, struct myrt_dev, stp);
+    struct stepper_move mv = {
+        .target = target,
+        .speed  = clamp_t(u32, speed, STEP_MIN_SPEED, STEP_MAX_SPEED),
+    };
+    unsigned long flags;
+    int ret = 0;
+
+    spin_lock_irqsave(&stp->lock, flags);
+    // under the lock: the stop path halts the stepper under it as well
+    if (READ_ONCE(md->core.estopped)) {
+        ret = -EPERM;
+    } else if (!kfifo_put(&stp->move_queue, mv)) {
+        ret = -EBUSY;
+    } else if (!stp->busy && stepper_next_move(stp)) {
+        stp->busy = true;
+        hrtimer_start(&stp->timer, ns_to_ktime(DIR_SETUP_NS), HRTIMER_MODE_REL);
+    }
+    spin_unlock_irqrestore(&stp->lock, flags);
+    return ret;
+}
+
+static bool stepper_present(struct myrt_dev *md)
+{
+    return md->stp.step_gpio && md->stp.dir_gpio;
+}
+
+// ====== Capture sample ring ======
+// The producer never waits for readers. A reader that falls more than
+// MYRT_RING_LEN records behind skips to the oldest record still in the ring
+// and is told how many it lost; the others are not affected.
+#define MYRT_RING_MASK  (MYRT_RING_LEN - 1)
+
+static void myrt_ring_init(struct myrt_ring *ring)
+{
+    raw_spin_lock_init(&ring->lock);
+    init_waitqueue_head(&ring->wq);
+}
+
+// An edge timestamp (CLOCK_MONOTONIC) in another clock base. BOOTTIME and
+// TAI are fixed offsets of MONOTONIC; MONOTONIC_RAW runs at its own rate,
+// so its offset is sampled now, microseconds after the edge, and is off
+// by that interval times the NTP frequency correction (a few ns at most).
+static ktime_t myrt_clock_from_mono(int clock, ktime_t mono)
+{
+    switch (clock) {
+    case MYRT_CLOCK_MONOTONIC_RAW:
+        return ktime_add(mono, ktime_sub(ktime_get_raw(), ktime_get()));
+    case MYRT_CLOCK_BOOTTIME:
+        return ktime_mono_to_any(mono, TK_OFFS_BOOT);
+    case MYRT_CLOCK_TAI:
+        return ktime_mono_to_any(mono, TK_OFFS_TAI);
+    default:
+        return mono;
+    }
+}
+
+// the core's pll_ref_clock, see "align"
+static ktime_t myrt_align_ref_clock(struct myrt_core *core, ktime_t mono)
+{
+    struct myrt_dev *md = container_of(core, struct myrt_dev, core);
+
+    return myrt_clock_from_mono(READ_ONCE(md->align_clock), mono);
+}
+
+// From the capture hook, hard IRQ or resample hrtimer context
+static void myrt_ring_push(struct myrt_ring *ring, struct capture_chan *cap,
+                           ktime_t edge, int clock)
+{
+    struct myrt_sample *s;
+    unsigned long flags, pos;
+
+    raw_spin_lock_irqsave(&ring->lock, flags);
+    pos = ring->reserve;
+    WRITE_ONCE(ring->reserve, pos + 1);
+    smp_wmb();      // reserve before the slot contents, see myrt_ring_get
+    s = &ring->buf[pos & MYRT_RING_MASK];
+    s->seq = ring->seq++;
+    s->ch = cap->ch;
+    s->period_ns = cap->st.period_ns;
+    s->ts_ns = ktime_to_ns(myrt_clock_from_mono(clock, edge));
+    s->ts_err_ns = cap->st.ts_err_ns;
+    s->ts_src = cap->st.ts_src;
+    s->ts_clock = clock;
+    smp_store_release(&ring->head, pos + 1);
+    raw_spin_unlock_irqrestore(&ring->lock, flags);
+
+    if (wq_has_sleeper(&ring->wq))
+        wake_up_interruptible(&ring->wq);
+}
+
+static bool myrt_ring_empty(struct myrt_ring *ring, struct myrt_reader *r)
+{
+    return smp_load_acquire(&ring->head) == r->cursor;
+}
+
+// Copy the record at the reader's cursor without moving it; false if there
+// is none. Records lost to the producer are added to r->dropped.
+static bool myrt_ring_get(struct myrt_ring *ring, struct myrt_reader *r,
+                          struct myrt_sample *s)
+{
+    unsigned long head, reserve;
+
+    for (;;) {
+        head = smp_load_acquire(&ring->head);
+        if (head == r->cursor)
+            return false;
+        if (head - r->cursor > MYRT_RING_LEN) {
+            r->dropped += head - MYRT_RING_LEN - r->cursor;
+            r->cursor = head - MYRT_RING_LEN;
+        }
+        *s = ring->buf[r->cursor & MYRT_RING_MASK];
+        smp_rmb();
+        // a producer that reserved the slot meanwhile may have torn the copy
+        reserve = READ_ONCE(ring->reserve);
+        if (reserve - r->cursor <= MYRT_RING_LEN)
+            return true;
+        r->dropped += reserve - MYRT_RING_LEN - r->cursor;
+        r->cursor = reserve - MYRT_RING_LEN;
+    }
+}
+
+// ====== BPF control law ======
+// The loaded law (myrt_bpf.c) runs right where the edge is accepted, so
+// the duty reacts within the same interrupt. Its result goes through
+// pwm_set_duty: slew limit, watchdog and e-stop still apply.
+static void myrt_ctl_edge(struct myrt_dev *md, struct capture_chan *cap,
+                          ktime_t edge)
+{
+    struct myrt_ctl *ctl = &md->ctl;
+    struct myrt_ctl_state st = {
+        .dev = md->id,
+        .in_ch = cap->ch,
+        .out_ch = READ_ONCE(ctl->out_ch),
+        .seq = cap->st.edges,
+        .period_ns = cap->st.period_ns,
+        .ts_ns = ktime_to_ns(edge),
+        .setpoint = READ_ONCE(ctl->setpoint),
+        .pwm_period_ns = READ_ONCE(md->core.period_ns),
+    };
+    ktime_t t0 = ktime_get();
+    int duty;
+    u32 ns;
+
+    st.duty = READ_ONCE(md->core.duty_target[st.out_ch]);
+    duty = myrt_bpf_step(&st);
+    ns = ktime_to_ns(ktime_sub(ktime_get(), t0));
+    WRITE_ONCE(ctl->calls, ctl->calls + 1);
+    if (ns > ctl->max_ns)
+        WRITE_ONCE(ctl->max_ns, ns);
+    if (duty >= 0)
+        pwm_set_duty(&md->core, st.out_ch, duty);
+}
+
+// ====== Capture consumers ======
+// Every accepted edge, from capture_accept in IRQ or hrtimer context
+static void myrt_capture_hook(struct capture_chan *cap, ktime_t edge)
+{
+    struct myrt_dev *md = container_of(cap->core, struct myrt_dev, core);
+
+    if (cap->ch == READ_ONCE(md->ctl.in_ch))
+        myrt_ctl_edge(md, cap, edge);
+    myrt_ring_push(&md->ring, cap, edge, READ_ONCE(md->clock));
+    if (md->counter)
+        myrt_counter_push(md->counter, cap->ch);
+    if (md->iio)
+        myrt_iio_push(md->iio, cap, edge);
+}
+
+// ====== Deferred capture work ======
+// The hard IRQ timestamps and queues the edge; the filter, PLL and the
+// consumers above run in an irq_work on a fixed CPU (a hard IRQ context
+// too, but after the handler returned; a kthread on PREEMPT_RT) or in a
+// SCHED_FIFO kthread worker. Both only ever run one drain at a time: the
+// irq_work because it is always queued on the same CPU.
+static void myrt_defer_irq_work(struct irq_work *iw)
+{
+    capture_drain(&container_of(iw, struct myrt_dev, defer.iw)->core);
+}
+
+static void myrt_defer_kthread_work(struct kthread_work *work)
+{
+    capture_drain(&container_of(work, struct myrt_dev, defer.work)->core);
+}
+
+// the core's capture_kick, from the capture hard IRQ or the HTE callback
+static void myrt_defer_kick(struct myrt_core *core)
+{
+    struct myrt_defer *d = &container_of(core, struct myrt_dev, core)->defer;
+
+    if (d->mode == DEFER_IRQ_WORK)
+        irq_work_queue_on(&d->iw, d->cpu);
+    else
+        kthread_queue_work(d->worker, &d->work);
+}
+
+// SCHED_FIFO at defer_prio, on 'cpu' unless that is < 0
+static struct kthread_worker *myrt_rt_worker(struct myrt_dev *md, int cpu,
+                                             const char *what)
+{
+    struct sched_attr attr = {
+        .size = sizeof(attr),
+        .sched_policy = SCHED_FIFO,
+        .sched_priority = clamp(defer_prio, 1, MAX_RT_PRIO - 1),
+    };
+    struct kthread_worker *worker;
+    int ret;
+
+    if (cpu >= 0)
+        worker = kthread_create_worker_on_cpu(cpu, 0, "myrt%d%s/%d", md->id, what, cpu);
+    else
+        worker = kthread_create_worker(0, "myrt%d%s", md->id, what);
+    if (IS_ERR(worker))
+        return worker;
+    // sched_setscheduler*() is not exported to modules any more
+    ret = sched_setattr_nocheck(worker->task, &attr);
+    if (ret)
+        dev_warn(md->dev, "worker myrt%d%s stays SCHED_OTHER (%d)\n", md->id, what, ret);
+    return worker;
+}
+
+static int myrt_defer_start(struct myrt_dev *md)
+{
+    struct myrt_defer *d = &md->defer;
+    int mode, ret;
+
+    mode = sysfs_match_string(myrt_defer_names, defer);
+    if (mode < 0)
+        return dev_err_probe(md->dev, mode, "unknown defer \"%s\"\n", defer);
+    d->cpu = defer_cpu;
+    if (mode == DEFER_NONE)
+        return 0;
+    if (d->cpu >= 0 && !cpu_online(d->cpu))
+        return dev_err_probe(md->dev, -EINVAL, "defer_cpu %d is not online\n", d->cpu);
+
+    if (mode == DEFER_IRQ_WORK) {
+        if (d->cpu < 0)
+            return dev_err_probe(md->dev, -EINVAL, "irq_work needs a defer_cpu\n");
+        init_irq_work(&d->iw, myrt_defer_irq_work);
+    } else {
+        kthread_init_work(&d->work, myrt_defer_kthread_work);
+        d->worker = myrt_rt_worker(md, d->cpu, "");
+        if (IS_ERR(d->worker)) {
+            ret = PTR_ERR(d->worker);
+            d->worker = NULL;
+            return dev_err_probe(md->dev, ret, "no capture worker\n");
+        }
+    }
+    d->mode = mode;
+    md->core.capture_kick = myrt_defer_kick;
+    return 0;
+}
+
+// after the capture IRQs are gone, so nothing queues any more
+static void myrt_defer_stop(struct myrt_dev *md)
+{
+    struct myrt_defer *d = &md->defer;
+
+    if (d->mode == DEFER_IRQ_WORK) {
+        irq_work_sync(&d->iw);
+    } else if (d->worker) {
+        kthread_flush_work(&d->work);
+        kthread_destroy_worker(d->worker);
+        d->worker = NULL;
+    }
+    md->core.capture_kick = NULL;
+}
+
+// ====== PWM lines that can sleep ======
+// Lines behind a chip that takes a mutex or sits on I2C/SPI (gpio-sim, port
+// expanders) cannot be written from the hrtimer. The timer keeps stepping
+// and records the levels; its pwm_kick queues pwm_write_levels on a
+// SCHED_FIFO kthread worker (defer_prio, defer_cpu), so every edge lands
+// with that thread's wakeup latency on top.
+static void myrt_out_work(struct kthread_work *work)
+{
+    pwm_write_levels(&container_of(work, struct myrt_dev, out_work)->core);
+}
+
+// the core's pwm_kick, from the PWM timer or pwm_estop
+static void myrt_out_kick(struct myrt_core *core)
+{
+    struct myrt_dev *md = container_of(core, struct myrt_dev, core);
+
+    kthread_queue_work(md->out_worker, &md->out_work);
+}
+
+static int myrt_out_start(struct myrt_dev *md, bool cansleep)
+{
+    int ret;
+
+    if (!cansleep)
+        return 0;
+    kthread_init_work(&md->out_work, myrt_out_work);
+    md->out_worker = myrt_rt_worker(md, defer_cpu, "-out");
+    if (IS_ERR(md->out_worker)) {
+        ret = PTR_ERR(md->out_worker);
+        md->out_worker = NULL;
+        return dev_err_probe(md->dev, ret, "no PWM output worker\n");
+    }
+    md->core.pwm_kick = myrt_out_kick;
+    dev_info(md->dev, "pwm-gpios can sleep, written from a kthread\n");
+    return 0;
+}
+
+// after the PWM timer and the e-stop IRQ are gone; the last levels are on
+// the lines when this returns
+static void myrt_out_stop(struct myrt_dev *md)
+{
+    if (!md->out_worker)
+        return;
+    kthread_flush_work(&md->out_work);
+    kthread_destroy_worker(md->out_worker);
+    md->out_worker = NULL;
+    md->core.pwm_kick = NULL;
+}
+
+// ====== Emergency stop ======
+// The hard half runs IRQF_NO_THREAD, also on PREEMPT_RT: pwm_estop only
+// takes a raw spinlock. The bridge and stepper locks are spinlock_t, so
+// the BLDC outputs are switched off in the thread, and the stepper and
+// servo lines forced low there once their timers are gone. Until then a
+// stepper or servo expiry sees estopped and ends itself.
+static irqreturn_t estop_irq_handler(int irq, void *dev_id)
+{
+    struct myrt_dev *md = dev_id;
+
+    pwm_estop(&md->core, ktime_get());
+    hrtimer_try_to_cancel(&md->stp.timer);
+    hrtimer_try_to_cancel(&md->servo.timer);
+    return IRQ_WAKE_THREAD;
+}
+
+static irqreturn_t estop_irq_thread(int irq, void *dev_id)
+{
+    struct myrt_dev *md = dev_id;
+
+    if (stepper_present(md)) {
+        hrtimer_cancel(&md->stp.timer);
+        stepper_halt(&md->stp);
+    }
+    if (servo_present(md)) {
+        hrtimer_cancel(&md->servo.timer);
+        servo_apply_levels(&md->servo, 0);
+    }
+    if (bldc_present(md)) {
+        spin_lock_irq(&md->bldc.lock);
+        md->bldc.enabled = false;
+        bldc_commutate(&md->bldc);
+        spin_unlock_irq(&md->bldc.lock);
+    }
+    dev_warn(md->dev, "emergency stop, PWM low after %u ns\n",
+             READ_ONCE(md->core.estop_latency_ns));
+    return IRQ_HANDLED;
+}
+
+static int myrt_request_estop(struct myrt_dev *md)
+{
+    unsigned long flags = IRQF_ONESHOT | IRQF_NO_THREAD;
+    int irq, ret;
+
+    if (!md->estop_gpio)
+        return 0;
+    // the edge into the stop level, whatever the line's polarity
+    flags |= gpiod_is_active_low(md->estop_gpio) ? IRQF_TRIGGER_FALLING
+                                                 : IRQF_TRIGGER_RISING;
+    irq = gpiod_to_irq(md->estop_gpio);
+    if (irq < 0)
+        return dev_err_probe(md->dev, irq, "no IRQ for estop-gpios\n");
+    ret = request_threaded_irq(irq, estop_irq_handler, estop_irq_thread, flags,
+                               dev_name(md->dev), md);
+    if (ret)
+        return dev_err_probe(md->dev, ret, "failed to request estop IRQ\n");
+    md->estop_irq = irq;
+    // already pressed: come up stopped
+    if (gpiod_get_value(md->estop_gpio))
+        pwm_estop(&md->core, ktime_get());
+    return 0;
+}
+
+// Per-channel shaping of duty writes:
+//   "slew <ch> <points/s>"         max duty change per second, 0 = off
+//   "lut <ch> <d0> <d10> .. <d100>" duty at every 10 % of speed; duty
+//                                  writes to the channel are a speed then
+//   "lut <ch> off"
+static int myrt_shape_command(struct myrt_dev *md, const char *msg)
+{
+    int p[PWM_LUT_POINTS];
+    unsigned int ch, rate;
+    char off[4];
+
+    if (sscanf(msg, "slew %u %u", &ch, &rate) == 2)
+        return pwm_set_slew(&md->core, ch, rate);
+    if (sscanf(msg, "lut %u %3s", &ch, off) == 2 && !strcmp(off, "off"))
+        return pwm_set_lut(&md->core, ch, NULL);
+    if (sscanf(msg, "lut %u %d %d %d %d %d %d %d %d %d %d %d", &ch,
+               &p[0], &p[1], &p[2], &p[3], &p[4], &p[5], &p[6], &p[7], &p[8],
+               &p[9], &p[10]) == 1 + PWM_LUT_POINTS)
+        return pwm_set_lut(&md->core, ch, p);
+    return -EINVAL;
+}
+
+// Heartbeat watchdog: "wdt <deadline_ms> <safe_duty> <slew>" arms it,
+// "wdt off" turns it off, "ping" is the heartbeat. slew is in duty points
+// per PWM period.
+static int myrt_wdt_command(struct myrt_dev *md, const char *msg)
+{
+    unsigned int ms;
+    int safe, slew;
+
+    if (sysfs_streq(msg, "off"))
+        return pwm_wdt_set(&md->core, 0, 0, 0);
+    if (sscanf(msg, "%u %d %d", &ms, &safe, &slew) != 3 || !ms)
+        return -EINVAL;
+    if (ms > U32_MAX / NSEC_PER_MSEC)
+        return -ERANGE;
+    return pwm_wdt_set(&md->core, ms * NSEC_PER_MSEC, safe, slew);
+}
+
+// Control law: "ctl <in_ch> <out_ch> <setpoint>" runs the loaded BPF law
+// on every edge of capture channel in_ch and writes its result to PWM
+// channel out_ch; "ctl off" stops that. Without a law loaded the edges
+// only count as calls.
+static int myrt_ctl_command(struct myrt_dev *md, const char *msg)
+{
+    struct myrt_ctl *ctl = &md->ctl;
+    unsigned int in, out;
+    char name[16];
+    u64 setpoint;
+
+    if (myrt_bpf_law_name(name, sizeof(name)) == -EOPNOTSUPP)
+        return -EOPNOTSUPP;
+    if (sysfs_streq(msg, "off")) {
+        WRITE_ONCE(ctl->in_ch, -1);
+        return 0;
+    }
+    if (sscanf(msg, "%u %u %llu", &in, &out, &setpoint) != 3)
+        return -EINVAL;
+    if (in >= md->core.n_meas || out >= md->core.n_pwm)
+        return -EINVAL;
+    // off while the rest changes, so no edge sees half of it
+    WRITE_ONCE(ctl->in_ch, -1);
+    WRITE_ONCE(ctl->out_ch, out);
+    WRITE_ONCE(ctl->setpoint, setpoint);
+    WRITE_ONCE(ctl->max_ns, 0);
+    WRITE_ONCE(ctl->in_ch, in);
+    return 0;
+}
+
+// "arm": leave the stopped state, all duties 0 and servos off, once the
+// input is released
+static int myrt_arm_command(struct myrt_dev *md)
+{
+    if (md->estop_gpio && gpiod_get_value(md->estop_gpio))
+        return -EBUSY;
+    if (!READ_ONCE(md->core.estopped))
+        return 0;
+    pwm_rearm(&md->core);
+    servo_start(md);
+    return 0;
+}
+
+// ====== Netlink notifications ======
+// Runs every notify_ms in process context. Alarms are found by comparing
+// the counters with the last run, samples are read from the capture ring
+// with a cursor of its own, so the capture and PWM paths do nothing extra
+// and nothing at all is built while no one listens.
+static void myrt_notify_alarms(struct myrt_dev *md)
+{
+    struct myrt_notify *n = &md->notify;
+    struct myrt_core *core = &md->core;
+    struct myrt_genl_alarm a[4 + MAX_CAP_CH];
+    struct capture_stats st;
+    unsigned int cnt = 0, ch;
+    u64 v;
+    s64 idle;
+
+    v = READ_ONCE(core->estops);
+    if (v != n->estops)
+        a[cnt++] = (struct myrt_genl_alarm){ MYRT_ALARM_ESTOP, 0,
+                                             READ_ONCE(core->estop_latency_ns) };
+    n->estops = v;
+    v = READ_ONCE(core->wdt.misses);
+    if (v != n->misses)
+        a[cnt++] = (struct myrt_genl_alarm){ MYRT_ALARM_WDT, 0, v };
+    n->misses = v;
+    v = READ_ONCE(core->overruns);
+    if (v != n->overruns)
+        a[cnt++] = (struct myrt_genl_alarm){ MYRT_ALARM_OVERRUN, 0, v - n->overruns };
+    n->overruns = v;
+    // PLL or period alignment lost its reference
+    if (READ_ONCE(core->pll.enabled) && !READ_ONCE(core->pll.locked) && n->locked)
+        a[cnt++] = (struct myrt_genl_alarm){ MYRT_ALARM_UNLOCK, 0,
+                                             abs(READ_ONCE(core->pll.phase_err_ns)) };
+    n->locked = READ_ONCE(core->pll.enabled) && READ_ONCE(core->pll.locked);
+
+    // a stall is reported once, until the channel has edges again
+    for (ch = 0; ch < core->n_meas; ch++) {
+        capture_snapshot(&core->caps[ch], &st);
+        if (st.edges != n->edges[ch]) {
+            n->edges[ch] = st.edges;
+            n->stalled &= ~BIT(ch);
+            continue;
+        }
+        idle = ktime_to_ns(ktime_sub(ktime_get(), st.last_edge));
+        if (!st.edges || !stall_ms || (n->stalled & BIT(ch)) ||
+            idle < (s64)stall_ms * NSEC_PER_MSEC)
+            continue;
+        n->stalled |= BIT(ch);
+        a[cnt++] = (struct myrt_genl_alarm){ MYRT_ALARM_STALL, ch, idle };
+    }
+
+    if (cnt && myrt_genl_alarms_wanted())
+        myrt_genl_send_alarms(md->id, a, cnt);
+}
+
+// Send batch[0..cnt), more messages for what did not fit. Whatever cannot
+// be sent is counted in dropped, which goes out with the next message that
+// does; false if sending failed.
+static bool myrt_notify_flush(struct myrt_dev *md, unsigned int cnt)
+{
+    struct myrt_notify *n = &md->notify;
+    unsigned int done = 0;
+    int sent;
+
+    while (done < cnt) {
+        sent = myrt_genl_send_samples(md->id, n->batch + done, cnt - done, n->dropped);
+        if (sent <= 0) {
+            n->dropped += cnt - done;
+            return false;
+        }
+        n->dropped = 0;
+        done += sent;
+    }
+    return true;
+}
+
+static void myrt_notify_samples(struct myrt_dev *md)
+{
+    struct myrt_notify *n = &md->notify;
+    struct myrt_reader r = { .md = md, .cursor = n->cursor };
+    uint decimate = max(READ_ONCE(notify_decimate), 1u);
+    struct myrt_sample s;
+    unsigned int cnt = 0;
+    bool ok;
+
+    if (!myrt_genl_samples_wanted()) {
+        n->cursor = smp_load_acquire(&md->ring.head);
+        n->dropped = 0;
+        return;
+    }
+    while (myrt_ring_get(&md->ring, &r, &s)) {
+        r.cursor++;
+        if (s.seq % decimate)
+            continue;
+        n->batch[cnt++] = (struct myrt_genl_sample){
+            .seq = s.seq, .period_ns = s.period_ns, .ts_ns = s.ts_ns, .ch = s.ch,
+        };
+        if (cnt < MYRT_NOTIFY_BATCH)
+            continue;
+        // edges overwritten in the ring before the work got to them
+        n->dropped += r.dropped;
+        r.dropped = 0;
+        ok = myrt_notify_flush(md, cnt);
+        cnt = 0;
+        if (!ok)
+            break;
+    }
+    n->dropped += r.dropped;
+    if (cnt)
+        myrt_notify_flush(md, cnt);
+    n->cursor = r.cursor;
+}
+
+static void myrt_notify_work(struct work_struct *work)
+{
+    struct myrt_dev *md = container_of(to_delayed_work(work), struct myrt_dev,
+                                       notify.work);
+
+    myrt_notify_alarms(md);
+    myrt_notify_samples(md);
+    schedule_delayed_work(&md->notify.work, msecs_to_jiffies(notify_ms));
+}
+
+static void myrt_notify_start(struct myrt_dev *md)
+{
+    md->notify.cursor = smp_load_acquire(&md->ring.head);
+    schedule_delayed_work(&md->notify.work, msecs_to_jiffies(notify_ms));
+}
+
+// ====== sysfs status ======
+static ssize_t step_position_show(struct device *dev,
+                                  struct device_attribute *attr, char *buf)
+{
+    struct myrt_dev *md = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%d\n", READ_ONCE(md->stp.position));
+}
+static DEVICE_ATTR_RO(step_position);
+
+static ssize_t bldc_step_show(struct device *dev,
+                              struct device_attribute *attr, char *buf)
+{
+    struct myrt_dev *md = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%d\n", READ_ONCE(md->bldc.step));
+}
+static DEVICE_ATTR_RO(bldc_step);
+
+static ssize_t bldc_commutations_show(struct device *dev,
+                                      struct device_attribute *attr, char *buf)
+{
+    struct myrt_dev *md = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%llu\n", READ_ONCE(md->bldc.commutations));
+}
+static DEVICE_ATTR_RO(bldc_commutations);
+
+static ssize_t bldc_faults_show(struct device *dev,
+                                struct device_attribute *attr, char *buf)
+{
+    struct myrt_dev *md = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%llu\n", READ_ONCE(md->bldc.faults));
+}
+static DEVICE_ATTR_RO(bldc_faults);
+
+static ssize_t bldc_latency_max_ns_show(struct device *dev,
+                                        struct device_attribute *attr, char *buf)
+{
+    struct myrt_dev *md = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%lld\n", READ_ONCE(md->bldc.lat_max_ns));
+}
+static DEVICE_ATTR_RO(bldc_latency_max_ns);
+
+static ssize_t pwm_overruns_show(struct device *dev,
+                                 struct device_attribute *attr, char *buf)
+{
+    struct myrt_dev *md = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%llu\n", READ_ONCE(md->core.overruns));
+}
+static DEVICE_ATTR_RO(pwm_overruns);
+
+static ssize_t capture_edges_show(struct device *dev,
+                                  struct device_attribute *attr, char *buf)
+{
+    struct myrt_dev *md = dev_get_drvdata(dev);
+    struct capture_stats st;
+    int ch, len = 0;
+
+    for (ch = 0; ch < md->core.n_meas; ch++) {
+        capture_snapshot(&md->core.caps[ch], &st);
+        len += sysfs_emit_at(buf, len, "%s%llu", ch ? " " : "", st.edges);
+    }
+    len += sysfs_emit_at(buf, len, "\n");
+    return len;
+}
+static DEVICE_ATTR_RO(capture_edges);
+
+static ssize_t capture_rejected_show(struct device *dev,
+                                     struct device_attribute *attr, char *buf)
+{
+    struct myrt_dev *md = dev_get_drvdata(dev);
+    struct capture_stats st;
+    int ch, len = 0;
+
+    for (ch = 0; ch < md->core.n_meas; ch++) {
+        capture_snapshot(&md->core.caps[ch], &st);
+        len += sysfs_emit_at(buf, len, "%s%llu", ch ? " " : "", st.rejected);
+    }
+    len += sysfs_emit_at(buf, len, "\n");
+    return len;
+}
+static DEVICE_ATTR_RO(capture_rejected);
+
+static ssize_t period_us_show(struct device *dev,
+                              struct device_attribute *attr, char *buf)
+{
+    struct myrt_dev *md = dev_get_drvdata(dev);
+    struct capture_stats st;
+    int ch, len = 0;
+
+    for (ch = 0; ch < md->core.n_meas; ch++) {
+        capture_snapshot(&md->core.caps[ch], &st);
+        len += sysfs_emit_at(buf, len, "%s%llu", ch ? " " : "",
+                             div_u64(st.period_ns, NSEC_PER_USEC));
+    }
+    len += sysfs_emit_at(buf, len, "\n");
+    return len;
+}
+static DEVICE_ATTR_RO(period_us);
+
+static ssize_t period_ns_show(struct device *dev,
+                              struct device_attribute *attr, char *buf)
+{
+    struct myrt_dev *md = dev_get_drvdata(dev);
+    struct capture_stats st;
+    int ch, len = 0;
+
+    for (ch = 0; ch < md->core.n_meas; ch++) {
+        capture_snapshot(&md->core.caps[ch], &st);
+        len += sysfs_emit_at(buf, len, "%s%llu", ch ? " " : "", st.period_ns);
+    }
+    len += sysfs_emit_at(buf, len, "\n");
+    return len;
+}
+static DEVICE_ATTR_RO(period_ns);
+
+static ssize_t clock_show(struct device *dev,
+                          struct device_attribute *attr, char *buf)
+{
+    struct myrt_dev *md = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%s\n", myrt_clock_names[READ_ONCE(md->clock)]);
+}
+static DEVICE_ATTR_RO(clock);
+
+static ssize_t capture_stage_ns_show(struct device *dev,
+                                     struct device_attribute *attr, char *buf)
+{
+    static const char * const names[CAPTURE_STAGES] = { "irq", "queue", "work" };
+    struct myrt_dev *md = dev_get_drvdata(dev);
+    u64 count, sum, lost = 0;
+    u32 max;
+    int ch, i, len = 0;
+
+    // all channels together
+    for (i = 0; i < CAPTURE_STAGES; i++) {
+        count = sum = max = 0;
+        for (ch = 0; ch < md->core.n_meas; ch++) {
+            struct capture_stage_stats *s = &md->core.caps[ch].stage[i];
+
+            count += READ_ONCE(s->count);
+            sum += READ_ONCE(s->sum_ns);
+            max = max(max, READ_ONCE(s->max_ns));
+        }
+        len += sysfs_emit_at(buf, len, "%s %llu %llu %u\n", names[i], count,
+                             count ? div64_u64(sum, count) : 0, max);
+    }
+    for (ch = 0; ch < md->core.n_meas; ch++)
+        lost += READ_ONCE(md->core.caps[ch].queue_lost);
+    len += sysfs_emit_at(buf, len, "lost %llu\n", lost);
+    return len;
+}
+static DEVICE_ATTR_RO(capture_stage_ns);
+
+static ssize_t capture_ts_src_show(struct device *dev,
+                                   struct device_attribute *attr, char *buf)
+{
+    struct myrt_dev *md = dev_get_drvdata(dev);
+    int ch, len = 0;
+
+    for (ch = 0; ch < md->core.n_meas; ch++)
+        len += sysfs_emit_at(buf, len, "%s%s", ch ? " " : "",
+                             md->hte[ch] ? "hte" : "sw");
+    len += sysfs_emit_at(buf, len, "\n");
+    return len;
+}
+static DEVICE_ATTR_RO(capture_ts_src);
+
+static ssize_t estop_show(struct device *dev,
+                          struct device_attribute *attr, char *buf)
+{
+    struct myrt_dev *md = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%d\n", READ_ONCE(md->core.estopped));
+}
+static DEVICE_ATTR_RO(estop);
+
+static ssize_t estops_show(struct device *dev,
+                           struct device_attribute *attr, char *buf)
+{
+    struct myrt_dev *md = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%llu\n", READ_ONCE(md->core.estops));
+}
+static DEVICE_ATTR_RO(estops);
+
+static ssize_t estop_latency_ns_show(struct device *dev,
+                                     struct device_attribute *attr, char *buf)
+{
+    struct myrt_dev *md = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%u %u\n", READ_ONCE(md->core.estop_latency_ns),
+                      READ_ONCE(md->core.estop_latency_max_ns));
+}
+static DEVICE_ATTR_RO(estop_latency_ns);
+
+static ssize_t wdt_expired_show(struct device *dev,
+                                struct device_attribute *attr, char *buf)
+{
+    struct myrt_dev *md = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%d\n", READ_ONCE(md->core.wdt.expired));
+}
+static DEVICE_ATTR_RO(wdt_expired);
+
+static ssize_t wdt_misses_show(struct device *dev,
+                               struct device_attribute *attr, char *buf)
+{
+    struct myrt_dev *md = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%llu\n", READ_ONCE(md->core.wdt.misses));
+}
+static DEVICE_ATTR_RO(wdt_misses);
+
+static ssize_t pll_locked_show(struct device *dev,
+                               struct device_attribute *attr, char *buf)
+{
+    struct myrt_dev *md = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%d\n",
+                      READ_ONCE(md->core.pll.enabled) && READ_ONCE(md->core.pll.locked));
+}
+static DEVICE_ATTR_RO(pll_locked);
+
+static ssize_t pll_phase_err_ns_show(struct device *dev,
+                                     struct device_attribute *attr, char *buf)
+{
+    struct myrt_dev *md = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%lld\n", READ_ONCE(md->core.pll.phase_err_ns));
+}
+static DEVICE_ATTR_RO(pll_phase_err_ns);
+
+static ssize_t pll_phase_err_max_ns_show(struct device *dev,
+                                         struct device_attribute *attr, char *buf)
+{
+    struct myrt_dev *md = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%lld\n", READ_ONCE(md->core.pll.phase_err_max_ns));
+}
+static DEVICE_ATTR_RO(pll_phase_err_max_ns);
+
+static ssize_t align_show(struct device *dev,
+                          struct device_attribute *attr, char *buf)
+{
+    struct myrt_dev *md = dev_get_drvdata(dev);
+    struct myrt_pll *pll = &md->core.pll;
+
+    if (!READ_ONCE(pll->enabled) || READ_ONCE(pll->ref) != PLL_REF_CLOCK)
+        return sysfs_emit(buf, "off\n");
+    return sysfs_emit(buf, "%s %lld %llu\n", myrt_clock_names[READ_ONCE(md->align_clock)],
+                      READ_ONCE(pll->ref_phase_ns), READ_ONCE(pll->jumps));
+}
+static DEVICE_ATTR_RO(align);
+
+static ssize_t ctl_show(struct device *dev,
+                        struct device_attribute *attr, char *buf)
+{
+    struct myrt_dev *md = dev_get_drvdata(dev);
+    struct myrt_ctl *ctl = &md->ctl;
+    char name[16] = "none";
+    int in = READ_ONCE(ctl->in_ch);
+
+    myrt_bpf_law_name(name, sizeof(name));
+    if (in < 0)
+        return sysfs_emit(buf, "%s off\n", name);
+    return sysfs_emit(buf, "%s %d %u %llu %llu %u\n", name, in,
+                      READ_ONCE(ctl->out_ch), READ_ONCE(ctl->setpoint),
+                      READ_ONCE(ctl->calls), READ_ONCE(ctl->max_ns));
+}
+static DEVICE_ATTR_RO(ctl);
+
+static struct attribute *myrt_attrs[] = {
+    &dev_attr_step_position.attr,
+    &dev_attr_bldc_step.attr,
+    &dev_attr_bldc_commutations.attr,
+    &dev_attr_bldc_faults.attr,
+    &dev_attr_bldc_latency_max_ns.attr,
+    &dev_attr_pll_locked.attr,
+    &dev_attr_pll_phase_err_ns.attr,
+    &dev_attr_pll_phase_err_max_ns.attr,
+    &dev_attr_align.attr,
+    &dev_attr_pwm_overruns.attr,
+    &dev_attr_estop.attr,
+    &dev_attr_estops.attr,
+    &dev_attr_estop_latency_ns.attr,
+    &dev_attr_wdt_expired.attr,
+    &dev_attr_wdt_misses.attr,
+    &dev_attr_ctl.attr,
+    &dev_attr_capture_edges.attr,
+    &dev_attr_capture_rejected.attr,
+    &dev_attr_period_us.attr,
+    &dev_attr_period_ns.attr,
+    &dev_attr_clock.attr,
+    &dev_attr_capture_ts_src.attr,
+    &dev_attr_capture_stage_ns.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(myrt);
+
+// ====== File operations ======
+// Every open file is a reader of the capture ring, starting at the next edge.
+static int myrt_open(struct inode *inode, struct file *filep)
+{
+    struct myrt_dev *md = container_of(inode->i_cdev, struct myrt_dev, cdev);
+    struct myrt_reader *r;
+
+    if (READ_ONCE(md->gone))
+        return -ENODEV;
+    r = kzalloc(sizeof(*r), GFP_KERNEL);
+    if (!r)
+        return -ENOMEM;
+    r->md = md;
+    r->cursor = smp_load_acquire(&md->ring.head);
+    r->clock = -1;
+    filep->private_data = r;
+    return stream_open(inode, filep);
+}
+
+static int myrt_release(struct inode *inode, struct file *filep)
+{
+    kfree(filep->private_data);
+    return 0;
+}
+
+// One line per accepted edge, "<seq> <ch> <period_ns> <ts_ns> sw|hte
+// <ts_err_ns>", oldest first. "dropped <n>" comes before the first record after a gap,
+// "clock <name>" before the first record and whenever the clock base of ts_ns
+// changes. Blocks until there is at least one line unless the file is O_NONBLOCK.
+// Only the ring is read, which lives as long as the file: no need for
+// gone_lock, an unbind just ends the wait.
+static ssize_t myrt_read(struct file *filep, char __user *buffer,
+                         size_t len, loff_t *offset)
+{
+    struct myrt_reader *r = filep->private_data;
+    struct myrt_dev *md = r->md;
+    struct myrt_ring *ring = &md->ring;
+    struct myrt_sample s;
+    char line[96];
+    size_t done = 0;
+    int n, ret;
+
+    while (myrt_ring_empty(ring, r)) {
+        if (READ_ONCE(md->gone))
+            return -ENODEV;
+        if (filep->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        ret = wait_event_interruptible(ring->wq, !myrt_ring_empty(ring, r) ||
+                                                 READ_ONCE(md->gone));
+        if (ret)
+            return ret;
+    }
+
+    while (myrt_ring_get(ring, r, &s)) {
+        if (r->dropped) {
+            n = scnprintf(line, sizeof(line), "dropped %llu\n", r->dropped);
+            if (n > len - done)
+                break;
+            if (copy_to_user(buffer + done, line, n))
+                return done ? done : -EFAULT;
+            done += n;
+            r->dropped = 0;
+        }
+        if (s.ts_clock != r->clock) {
+            n = scnprintf(line, sizeof(line), "clock %s\n",
+                          myrt_clock_names[s.ts_clock]);
+            if (n > len - done)
+                break;
+            if (copy_to_user(buffer + done, line, n))
+                return done ? done : -EFAULT;
+            done += n;
+            r->clock = s.ts_clock;
+        }
+        n = scnprintf(line, sizeof(line), "%llu %u %llu %lld %s %u\n",
+                      s.seq, s.ch, s.period_ns, s.ts_ns,
+                      s.ts_src == CAPTURE_TS_HTE ? "hte" : "sw", s.ts_err_ns);
+        if (n > len - done)
+            break;
+        if (copy_to_user(buffer + done, line, n))
+            return done ? done : -EFAULT;
+        done += n;
+        r->cursor++;
+    }
+    // a buffer too small for a single line would never make progress
+    return done ? done : -EINVAL;
+}
+
+static __poll_t myrt_poll(struct file *filep, poll_table *wait)
+{
+    struct myrt_reader *r = filep->private_data;
+    __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+    poll_wait(filep, &r->md->ring.wq, wait);
+    if (!myrt_ring_empty(&r->md->ring, r))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    else if (READ_ONCE(r->md->gone))
+        mask = EPOLLHUP | EPOLLERR;
+    return mask;
+}
+
+// Stepper commands:
+//   "move <pos> <speed>"  queue a move to absolute <pos> at <speed> steps/s
+//   "accel <steps/s^2>", "jerk <steps/s^3>", "ramp trap|scurve"
+static int myrt_stepper_command(struct myrt_dev *md, const char *msg)
+{
+    struct myrt_stepper *stp = &md->stp;
+    s32 pos;
+    u32 val;
+
+    if (!stepper_present(md))
+        return -ENODEV;
+    if (sscanf(msg, "move %d %u", &pos, &val) == 2)
+        return stepper_queue_move(stp, pos, val);
+    // ramp parameters are picked up by the next move
+    if (sscanf(msg, "accel %u", &val) == 1 && val) {
+        if (val > STEP_MAX_ACCEL)
+            return -ERANGE;
+        WRITE_ONCE(stp->accel, val);
+        return 0;
+    }
+    if (sscanf(msg, "jerk %u", &val) == 1 && val) {
+        if (val > STEP_MAX_JERK)
+            return -ERANGE;
+        WRITE_ONCE(stp->jerk, val);
+        return 0;
+    }
+    if (sysfs_streq(msg, "ramp trap")) {
+        WRITE_ONCE(stp->ramp, RAMP_TRAP);
+        return 0;
+    }
+    if (sysfs_streq(msg, "ramp scurve")) {
+        WRITE_ONCE(stp->ramp, RAMP_SCURVE);
+        return 0;
+    }
+    return -EINVAL;
+}
+
+// BLDC commands: "bldc on|off|fwd|rev", "bldc duty <percent>"
+static int myrt_bldc_command(struct myrt_dev *md, const char *msg)
+{
+    struct myrt_bldc *bldc = &md->bldc;
+    unsigned long flags;
+    int duty, ret = 0;
+
+    if (!bldc_present(md))
+        return -ENODEV;
+    if (sscanf(msg, "duty %d", &duty) == 1) {
+        WRITE_ONCE(bldc->duty, clamp(duty, 0, 100));
+        return 0;
+    }
+
+    spin_lock_irqsave(&bldc->lock, flags);
+    if (sysfs_streq(msg, "on") && READ_ONCE(md->core.estopped))
+        ret = -EPERM;
+    else if (sysfs_streq(msg, "on"))
+        bldc->enabled = true;
+    else if (sysfs_streq(msg, "off"))
+        bldc->enabled = false;
+    else if (sysfs_streq(msg, "fwd"))
+        bldc->reverse = false;
+    else if (sysfs_streq(msg, "rev"))
+        bldc->reverse = true;
+    else
+        ret = -EINVAL;
+    // pick up the new state right away instead of at the next hall edge
+    bldc_commutate(bldc);
+    spin_unlock_irqrestore(&bldc->lock, flags);
+    return ret;
+}
+
+// Servo command: "servo <ch> <us> [<ch> <us> ...]". All pairs of one write
+// take effect in the same frame; 0 us stops a channel's pulses.
+static int myrt_servo_command(struct myrt_dev *md, const char *msg)
+{
+    struct myrt_servo *servo = &md->servo;
+    unsigned int ch[MAX_SERVO], us[MAX_SERVO];
+    unsigned long flags;
+    int i, n = 0, used;
+
+    if (!servo_present(md))
+        return -ENODEV;
+    while (n < MAX_SERVO && sscanf(msg, "%u %u%n", &ch[n], &us[n], &used) == 2) {
+        if (ch[n] >= servo->n)
+            return -EINVAL;
+        if (us[n])
+            us[n] = clamp_t(u32, us[n], SERVO_MIN_US, SERVO_MAX_US);
+        msg += used;
+        n++;
+    }
+    // all or nothing: a tail that is not a pair rejects the whole write
+    if (!n || *skip_spaces(msg))
+        return -EINVAL;
+
+    spin_lock_irqsave(&servo->lock, flags);
+    for (i = 0; i < n; i++)
+        servo->pending[ch[i]] = us[i];
+    spin_unlock_irqrestore(&servo->lock, flags);
+    return 0;
+}
+
+// Glitch filter: "deglitch <ch> <min_ns> [<resample_ns>]". Edges closer
+// than min_ns to the last accepted one are dropped; with resample_ns the
+// level is re-read that long after the edge and the edge kept only if the
+// input is still high. The re-read is in an hrtimer, so not on capture
+// lines that can sleep.
+static int myrt_deglitch_command(struct myrt_dev *md, const char *msg)
+{
+    unsigned int ch, min_ns, resample_ns = 0;
+
+    if (sscanf(msg, "%u %u %u", &ch, &min_ns, &resample_ns) < 2)
+        return -EINVAL;
+    if (ch >= md->core.n_meas)
+        return -EINVAL;
+    if (resample_ns && md->meas_cansleep)
+        return -EOPNOTSUPP;
+    capture_set_deglitch(&md->core.caps[ch], min_ns, resample_ns);
+    return 0;
+}
+
+// Clock base of the edge stream timestamps: "clock monotonic|monotonic_raw|
+// boottime|tai". Periods are always measured on CLOCK_MONOTONIC.
+static int myrt_clock_command(struct myrt_dev *md, const char *msg)
+{
+    int clock = sysfs_match_string(myrt_clock_names, msg);
+
+    if (clock < 0)
+        return clock;
+    WRITE_ONCE(md->clock, clock);
+    return 0;
+}
+
+// PLL gains from the module parameters, taken when the loop is switched on
+static void myrt_pll_gains(struct myrt_core *core)
+{
+    core->pll.kp_shift = clamp(pll_kp_shift, 0, 30);
+    core->pll.ki_shift = clamp(pll_ki_shift, 0, 30);
+    core->pll.lock_ns = pll_lock_ns;
+}
+
+// Period alignment: "align <clock> [<phase_ns>]" starts every PWM period
+// phase_ns past a multiple of the period on that clock (tai, for boards
+// synced by PTP), "align off" ends it, as does "pll off". The PLL does it,
+// so "pll on" replaces it and the pll_* attributes report on it.
+static int myrt_align_command(struct myrt_dev *md, const char *msg)
+{
+    s64 phase_ns = 0;
+    char name[16];
+    int clock;
+
+    if (sysfs_streq(msg, "off")) {
+        pll_set_enabled(&md->core, false);
+        return 0;
+    }
+    if (sscanf(msg, "%15s %lld", name, &phase_ns) < 1)
+        return -EINVAL;
+    clock = sysfs_match_string(myrt_clock_names, name);
+    if (clock < 0)
+        return clock;
+    WRITE_ONCE(md->align_clock, clock);
+    myrt_pll_gains(&md->core);
+    pll_align_clock(&md->core, phase_ns);
+    return 0;
+}
+
+static int myrt_command(struct myrt_dev *md, const char *msg)
+{
+    struct myrt_core *core = &md->core;
+    unsigned int us;
+
+    // PWM period of all channels, from the next period start on
+    if (sscanf(msg, "period %u", &us) == 1) {
+        // in range before the conversion, which would wrap in u32
+        if (us > PWM_PERIOD_MAX_NS / NSEC_PER_USEC)
+            return -EINVAL;
+        return pwm_set_period(core, us * NSEC_PER_USEC);
+    }
+    if (str_has_prefix(msg, "bldc "))
+        return myrt_bldc_command(md, msg + 5);
+    if (str_has_prefix(msg, "servo "))
+        return myrt_servo_command(md, msg + 6);
+    if (str_has_prefix(msg, "deglitch "))
+        return myrt_deglitch_command(md, msg + 9);
+    if (str_has_prefix(msg, "clock "))
+        return myrt_clock_command(md, msg + 6);
+    if (sysfs_streq(msg, "arm"))
+        return myrt_arm_command(md);
+    if (sysfs_streq(msg, "ping")) {
+        pwm_wdt_ping(core);
+        return 0;
+    }
+    if (str_has_prefix(msg, "wdt "))
+        return myrt_wdt_command(md, msg + 4);
+    if (str_has_prefix(msg, "ctl "))
+        return myrt_ctl_command(md, msg + 4);
+    if (str_has_prefix(msg, "slew ") || str_has_prefix(msg, "lut "))
+        return myrt_shape_command(md, msg);
+    if (sysfs_streq(msg, "pll on")) {
+        myrt_pll_gains(core);
+        pll_set_enabled(core, true);
+        return 0;
+    }
+    if (str_has_prefix(msg, "align "))
+        return myrt_align_command(md, msg + 6);
+    if (sysfs_streq(msg, "pll off")) {
+        pll_set_enabled(core, false);
+        return 0;
+    }
+    return myrt_stepper_command(md, msg);
+}
+
+// "<duty>" sets every channel, "<ch> <duty>" a single one (a speed on
+// channels with a table), anything starting with a letter is a command
+// (see myrt_command)
+static ssize_t myrt_write_locked(struct myrt_dev *md, const char *msg, size_t len)
+{
+    struct myrt_core *core = &md->core;
+    int a, b, ch, ret;
+
+    if (isalpha(msg[0])) {
+        ret = myrt_command(md, msg);
+        return ret ? ret : len;
+    }
+
+    switch (sscanf(msg, "%d %d", &a, &b)) {
+    case 1:
+        for (ch = 0; ch < core->n_pwm; ch++)
+            pwm_set_speed(core, ch, a);
+        dev_info(md->dev, "duty cycle set to %d%%\n", core->duty_target[0]);
+        break;
+    case 2:
+        if (a < 0 || a >= core->n_pwm) return -EINVAL;
+        pwm_set_speed(core, a, b);
+        dev_info(md->dev, "channel %d duty cycle set to %d%%\n", a, core->duty_target[a]);
+        break;
+    default:
+        return -EINVAL;
+    }
+    return len;
+}
+
+// Longest write: "servo" with all MAX_SERVO channels at 4-digit widths
+// is 6 + 16 * 8 characters
+#define MYRT_CMD_LEN    192
+
+// The commands drive the lines, which go with the binding: myrt_remove
+// waits for a write in progress and later ones fail.
+static ssize_t myrt_write(struct file *filep, const char __user *buffer,
+                          size_t len, loff_t *offset)
+{
+    struct myrt_dev *md = ((struct myrt_reader *)filep->private_data)->md;
+    char msg[MYRT_CMD_LEN];
+    ssize_t ret;
+    if (len >= sizeof(msg)) return -EINVAL;
+    if (copy_from_user(msg, buffer, len)) return -EFAULT;
+    msg[len] = '\0';
+
+    down_read(&md->gone_lock);
+    ret = md->gone ? -ENODEV : myrt_write_locked(md, msg, len);
+    up_read(&md->gone_lock);
+    return ret;
+}
+
+static struct file_operations fops = {
+    .owner   = THIS_MODULE,
+    .open    = myrt_open,
+    .release = myrt_release,
+    .read    = myrt_read,
+    .write   = myrt_write,
+    .poll    = myrt_poll,
+};
+
+// ====== Probe & Remove ======
+// A line behind I2C/SPI, or of a chip that takes a mutex (gpio-sim)
+static bool myrt_cansleep(struct gpio_descs *descs)
+{
+    unsigned int i;
+
+    for (i = 0; descs && i < descs->ndescs; i++) {
+        if (gpiod_cansleep(descs->desc[i]))
+            return true;
+    }
+    return false;
+}
+
+// The stepper, BLDC and servo outputs are driven and sampled from hrtimers
+// and hard IRQs with the non-sleeping gpiod calls only. PWM lines that can
+// sleep go through a kthread (myrt_out_start); capture lines only take the
+// edge IRQ, which such chips deliver as well, and no resampling.
+static int myrt_check_atomic(struct device *dev, struct gpio_descs *descs,
+                             const char *con_id)
+{
+    if (myrt_cansleep(descs))
+        return dev_err_probe(dev, -EINVAL,
+                             "%s-gpios can sleep, not usable from an hrtimer\n", con_id);
+    return 0;
+}
+
+// Lines by con_id, from the device tree node, a software node or the pin
+// instance's lookup table: "pwm" and "capture" are required, "step"/"dir",
+// "hall"/"bldc" and "servo" add the stepper, BLDC and servo outputs,
+// "estop" the emergency stop input.
+static int myrt_get_gpios(struct myrt_dev *md)
+{
+    struct device *dev = md->dev;
+    struct gpio_descs *pwm, *cap, *halls, *bridge, *servos;
+    int ret;
+
+    pwm = devm_gpiod_get_array(dev, "pwm", GPIOD_OUT_LOW);
+    if (IS_ERR(pwm))
+        return dev_err_probe(dev, PTR_ERR(pwm), "no pwm-gpios\n");
+    if (pwm->ndescs > MAX_PWM_CH)
+        return dev_err_probe(dev, -EINVAL, "more than %d pwm-gpios\n", MAX_PWM_CH);
+
+    cap = devm_gpiod_get_array(dev, "capture", GPIOD_IN);
+    if (IS_ERR(cap))
+        return dev_err_probe(dev, PTR_ERR(cap), "no capture-gpios\n");
+    if (cap->ndescs > MAX_CAP_CH)
+        return dev_err_probe(dev, -EINVAL, "more than %d capture-gpios\n", MAX_CAP_CH);
+
+    md->meas_cansleep = myrt_cansleep(cap);
+    md->core.pwm_gpios = pwm;
+    md->core.meas_gpios = cap;
+    md->core.n_pwm = pwm->ndescs;
+    md->core.n_meas = cap->ndescs;
+
+    // stepper is optional, both lookups return NULL without the lines
+    md->stp.step_gpio = devm_gpiod_get_optional(dev, "step", GPIOD_OUT_LOW);
+    if (IS_ERR(md->stp.step_gpio))
+        return PTR_ERR(md->stp.step_gpio);
+    md->stp.dir_gpio = devm_gpiod_get_optional(dev, "dir", GPIOD_OUT_LOW);
+    if (IS_ERR(md->stp.dir_gpio))
+        return PTR_ERR(md->stp.dir_gpio);
+    if ((md->stp.step_gpio && gpiod_cansleep(md->stp.step_gpio)) ||
+        (md->stp.dir_gpio && gpiod_cansleep(md->stp.dir_gpio)))
+        return dev_err_probe(dev, -EINVAL, "step/dir-gpios can sleep\n");
+
+    // BLDC is optional as well, but takes all three halls and six switches
+    bridge = devm_gpiod_get_array_optional(dev, "bldc", GPIOD_OUT_LOW);
+    if (IS_ERR(bridge))
+        return PTR_ERR(bridge);
+    halls = devm_gpiod_get_array_optional(dev, "hall", GPIOD_IN);
+    if (IS_ERR(halls))
+        return PTR_ERR(halls);
+    if (!halls != !bridge ||
+        (halls && (halls->ndescs != N_HALL || bridge->ndescs != N_PHASE_OUT)))
+        return dev_err_probe(dev, -EINVAL, "BLDC needs %d hall-gpios and %d bldc-gpios\n",
+                             N_HALL, N_PHASE_OUT);
+    ret = myrt_check_atomic(dev, halls, "hall");
+    if (!ret)
+        ret = myrt_check_atomic(dev, bridge, "bldc");
+    if (ret)
+        return ret;
+    md->bldc.halls = halls;
+    md->bldc.bridge = bridge;
+
+    servos = devm_gpiod_get_array_optional(dev, "servo", GPIOD_OUT_LOW);
+    if (IS_ERR(servos))
+        return PTR_ERR(servos);
+    if (servos && servos->ndescs > MAX_SERVO)
+        return dev_err_probe(dev, -EINVAL, "more than %d servo-gpios\n", MAX_SERVO);
+    ret = myrt_check_atomic(dev, servos, "servo");
+    if (ret)
+        return ret;
+    md->servo.gpios = servos;
+    md->servo.n = servos ? servos->ndescs : 0;
+
+    md->estop_gpio = devm_gpiod_get_optional(dev, "estop", GPIOD_IN);
+    if (IS_ERR(md->estop_gpio))
+        return PTR_ERR(md->estop_gpio);
+    return 0;
+}
+
+static void myrt_init_state(struct myrt_dev *md)
+{
+    // PWM engine and capture channels, the PWM timer starts in probe
+    myrt_core_init(&md->core);
+    md->core.capture_hook = myrt_capture_hook;
+    md->ctl.in_ch = -1;
+    md->core.pll_ref_clock = myrt_align_ref_clock;
+    myrt_ring_init(&md->ring);
+    init_rwsem(&md->gone_lock);
+    INIT_DELAYED_WORK(&md->notify.work, myrt_notify_work);
+    if (bldc_present(md))
+        md->core.pwm_step_hook = bldc_pwm_step;
+
+    // stepper timer, started by the first queued move
+    INIT_KFIFO(md->stp.move_queue);
+    spin_lock_init(&md->stp.lock);
+    md->stp.accel = 2000;
+    md->stp.jerk = 20000;
+    md->stp.ramp = RAMP_TRAP;
+    hrtimer_init(&md->stp.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    md->stp.timer.function = step_timer_callback;
+
+    spin_lock_init(&md->bldc.lock);
+    md->bldc.step = -1;
+
+    spin_lock_init(&md->servo.lock);
+    hrtimer_init(&md->servo.timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    md->servo.timer.function = servo_timer_callback;
+}
+
+static void myrt_free_capture_irqs(struct myrt_dev *md, int n)
+{
+    while (--n >= 0) {
+        if (md->hte[n]) {
+            myrt_hte_release(md->hte[n]);
+            md->hte[n] = NULL;
+        } else {
+            free_irq(md->core.caps[n].irq, &md->core.caps[n]);
+        }
+    }
+}
+
+// Software timestamps are taken on entry of the hard IRQ handler. Forced
+// IRQ threading (threadirqs) would move that into a thread, so the capture
+// IRQ opts out of it. On PREEMPT_RT only when the rest of the path is
+// deferred: the capture consumers take sleeping locks there.
+static unsigned long myrt_capture_irqf(struct myrt_dev *md)
+{
+    unsigned long flags = IRQF_TRIGGER_RISING | IRQF_ONESHOT;
+
+    if (!IS_ENABLED(CONFIG_PREEMPT_RT) || md->defer.mode != DEFER_NONE)
+        flags |= IRQF_NO_THREAD;
+    return flags;
+}
+
+static int myrt_request_irqs(struct myrt_dev *md)
+{
+    struct myrt_bldc *bldc = &md->bldc;
+    u32 min_ns = deglitch_ns;
+    const char *clock;
+    int ret, i;
+
+    device_property_read_u32(md->dev, "deglitch-ns", &min_ns);
+    if (!device_property_read_string(md->dev, "clock-base", &clock)) {
+        ret = sysfs_match_string(myrt_clock_names, clock);
+        if (ret < 0)
+            dev_warn(md->dev, "unknown clock-base \"%s\", using monotonic\n", clock);
+        else
+            md->clock = ret;
+    }
+    for (i = 0; i < md->core.n_meas; i++) {
+        struct capture_chan *cap = &md->core.caps[i];
+
+        capture_set_deglitch(cap, min_ns, 0);
+        // timestamps from the HTE where the node has one for this input
+        md->hte[i] = myrt_hte_request(md->dev, cap, md->core.meas_gpios->desc[i]);
+        if (IS_ERR(md->hte[i])) {
+            ret = PTR_ERR(md->hte[i]);
+            md->hte[i] = NULL;
+            myrt_free_capture_irqs(md, i);
+            return ret;
+        }
+        if (md->hte[i])
+            continue;
+
+        cap->irq = gpiod_to_irq(md->core.meas_gpios->desc[i]);
+        ret = cap->irq < 0 ? cap->irq :
+              request_irq(cap->irq, gpio_irq_handler, myrt_capture_irqf(md),
+                          dev_name(md->dev), cap);
+        if (ret) {
+            dev_err(md->dev, "failed to request capture IRQ %d\n", i);
+            myrt_free_capture_irqs(md, i);
+            return ret;
+        }
+    }
+
+    // every hall edge commutates, both directions
+    if (!bldc_present(md))
+        return 0;
+    for (i = 0; i < N_HALL; i++) {
+        bldc->irqs[i] = gpiod_to_irq(bldc->halls->desc[i]);
+        ret = bldc->irqs[i] < 0 ? bldc->irqs[i] :
+              request_irq(bldc->irqs[i], hall_irq_handler,
+                          IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING,
+                          dev_name(md->dev), bldc);
+        if (ret) {
+            dev_err(md->dev, "failed to request hall IRQ %d\n", i);
+            while (--i >= 0)
+                free_irq(bldc->irqs[i], bldc);
+            myrt_free_capture_irqs(md, md->core.n_meas);
+            return ret;
+        }
+    }
+    return 0;
+}
+
+// the kernel-facing frontends are optional, one that fails is left out
+static void myrt_add_frontends(struct myrt_dev *md)
+{
+    md->counter = myrt_counter_register(md->dev, &md->core);
+    if (IS_ERR(md->counter)) {
+        dev_warn(md->dev, "no counter device (%ld)\n", PTR_ERR(md->counter));
+        md->counter = NULL;
+    }
+    md->iio = myrt_iio_register(md->dev, &md->core);
+    if (IS_ERR(md->iio)) {
+        dev_warn(md->dev, "no IIO device (%ld)\n", PTR_ERR(md->iio));
+        md->iio = NULL;
+    }
+    // the same channels for kernel PWM consumers and /sys/class/pwm
+    md->pwm = myrt_pwm_register(md->dev, &md->core);
+    if (IS_ERR(md->pwm)) {
+        dev_warn(md->dev, "no pwm_chip (%ld), char device only\n", PTR_ERR(md->pwm));
+        md->pwm = NULL;
+    }
+}
+
+static void myrt_remove_frontends(struct myrt_dev *md)
+{
+    if (md->pwm)
+        myrt_pwm_unregister(md->pwm);
+    if (md->iio)
+        myrt_iio_unregister(md->iio);
+    if (md->counter)
+        myrt_counter_unregister(md->counter);
+}
+
+// Stop everything that drives a line. The IRQs go first, so no edge reaches
+// the capture hook or restarts a timer once this returns.
+static void myrt_stop(struct myrt_dev *md)
+{
+    int i;
+
+    cancel_delayed_work_sync(&md->notify.work);
+    myrt_free_capture_irqs(md, md->core.n_meas);
+    myrt_defer_stop(md);
+    if (bldc_present(md)) {
+        for (i = 0; i < N_HALL; i++)
+            free_irq(md->bldc.irqs[i], &md->bldc);
+    }
+    myrt_core_stop(&md->core);
+    // the e-stop stays armed until the engine is stopped anyway
+    if (md->estop_irq)
+        free_irq(md->estop_irq, md);
+    myrt_out_stop(md);
+    hrtimer_cancel(&md->stp.timer);
+    hrtimer_cancel(&md->servo.timer);
+    if (servo_present(md))
+        servo_apply_levels(&md->servo, 0);
+    if (bldc_present(md)) {
+        // leave the bridge off
+        spin_lock_irq(&md->bldc.lock);
+        md->bldc.enabled = false;
+        bldc_commutate(&md->bldc);
+        spin_unlock_irq(&md->bldc.lock);
+    }
+}
+
+// Last reference to cdev_dev gone: the instance is unbound and no file is
+// open any more.
+static void myrt_dev_release(struct device *dev)
+{
+    struct myrt_dev *md = container_of(dev, struct myrt_dev, cdev_dev);
+
+    ida_free(&myrt_ida, md->id);
+    kfree(md->ring.buf);
+    kfree(md);
+}
+
+static int myrt_probe(struct platform_device *pdev)
+{
+    struct device *dev = &pdev->dev;
+    struct myrt_dev *md;
+    dev_t devt;
+    int ret;
+
+    // not devm: open files keep it past the unbind
+    md = kzalloc(sizeof(*md), GFP_KERNEL);
+    if (!md)
+        return -ENOMEM;
+    md->dev = dev;
+    platform_set_drvdata(pdev, md);
+
+    ret = myrt_get_gpios(md);
+    if (ret)
+        goto err_free;
+    md->ring.buf = kcalloc(MYRT_RING_LEN, sizeof(*md->ring.buf), GFP_KERNEL);
+    if (!md->ring.buf) {
+        ret = -ENOMEM;
+        goto err_free;
+    }
+    myrt_init_state(md);
+
+    md->id = ida_alloc_max(&myrt_ida, MYRT_MAX_DEVS - 1, GFP_KERNEL);
+    if (md->id < 0) {
+        ret = md->id;
+        goto err_free;
+    }
+    devt = MKDEV(MAJOR(myrt_devt), md->id);
+
+    // registered before the capture IRQs, so every edge finds them
+    myrt_add_frontends(md);
+    // before anything can step the PWM or stop it
+    ret = myrt_out_start(md, myrt_cansleep(md->core.pwm_gpios));
+    if (ret)
+        goto err_frontends;
+    ret = myrt_defer_start(md);
+    if (ret)
+        goto err_out;
+    ret = myrt_request_irqs(md);
+    if (ret)
+        goto err_defer;
+    ret = myrt_request_estop(md);
+    if (ret)
+        goto err_stop;
+
+    // setup PWM hrtimer
+    myrt_core_start(&md->core);
+    myrt_notify_start(md);
+
+    // servo frames run from probe on
+    servo_start(md);
+
+    // the cdev holds cdev_dev, and so md, for as long as a file is open
+    cdev_init(&md->cdev, &fops);
+    md->cdev.owner = THIS_MODULE;
+    device_initialize(&md->cdev_dev);
+    md->cdev_dev.class = myrt_class;
+    md->cdev_dev.parent = dev;
+    md->cdev_dev.devt = devt;
+    md->cdev_dev.groups = myrt_groups;
+    md->cdev_dev.release = myrt_dev_release;
+    dev_set_drvdata(&md->cdev_dev, md);
+    ret = dev_set_name(&md->cdev_dev, DEVICE_NAME "%d", md->id);
+    if (!ret)
+        ret = cdev_device_add(&md->cdev, &md->cdev_dev);
+    if (ret)
+        goto err_put;
+
+    dev_info(dev, "/dev/%s: %u PWM, %u capture%s%s%s%s\n", dev_name(&md->cdev_dev),
+             md->core.n_pwm, md->core.n_meas,
+             stepper_present(md) ? ", stepper" : "",
+             bldc_present(md) ? ", BLDC" : "",
+             servo_present(md) ? ", servos" : "",
+             md->estop_gpio ? ", e-stop" : "");
+    return 0;
+
+err_put:
+    myrt_stop(md);
+    myrt_remove_frontends(md);
+    // myrt_dev_release frees the rest
+    put_device(&md->cdev_dev);
+    return ret;
+err_stop:
+    myrt_stop(md);
+err_defer:
+    myrt_defer_stop(md);
+err_out:
+    myrt_out_stop(md);
+err_frontends:
+    myrt_remove_frontends(md);
+    ida_free(&myrt_ida, md->id);
+err_free:
+    kfree(md->ring.buf);
+    kfree(md);
+    return ret;
+}
+
+// Files still open keep md: from here on their reads end, writes fail with
+// ENODEV and none of them touches the lines or the frontends again.
+static void myrt_remove(struct platform_device *pdev)
+{
+    struct myrt_dev *md = platform_get_drvdata(pdev);
+
+    down_write(&md->gone_lock);
+    md->gone = true;
+    up_write(&md->gone_lock);
+    wake_up_interruptible(&md->ring.wq);
+
+    cdev_device_del(&md->cdev, &md->cdev_dev);
+    myrt_stop(md);
+    myrt_remove_frontends(md);
+    put_device(&md->cdev_dev);
+}
+
+static const struct of_device_id myrt_of_match[] = {
+    { .compatible = "hu,myrt" },
+    { }
+};
+MODULE_DEVICE_TABLE(of, myrt_of_match);
+
+static struct platform_driver myrt_driver = {
+    .probe      = myrt_probe,
+    .remove_new = myrt_remove,
+    .driver = {
+        .name = DEVICE_NAME,
+        .of_match_table = myrt_of_match,
+    },
+};
+
+// ====== Pin instance ======
+// Map the pin numbers given as module parameters onto the con_ids above for
+// the platform device "myrt.0", which then binds like any firmware instance.
+static int myrt_add_lookup(void)
+{
+    int i, n = 0;
+
+    // PWM, MEAS, STEP/DIR, halls, bridge, servos and e-stop, plus the zeroed terminator
+    myrt_lookup = kzalloc(struct_size(myrt_lookup, table,
+                                      n_pwm + n_meas + 2 + N_HALL + N_PHASE_OUT + n_servo + 1 + 1),
+                          GFP_KERNEL);
+    if (!myrt_lookup) return -ENOMEM;
+    myrt_lookup->dev_id = DEVICE_NAME ".0";
+
+    for (i = 0; i < n_pwm; i++)
+        myrt_lookup->table[n++] = (struct gpiod_lookup)
+            GPIO_LOOKUP_IDX(gpio_chip, pwm_gpios[i], "pwm", i, GPIO_ACTIVE_HIGH);
+    for (i = 0; i < n_meas; i++)
+        myrt_lookup->table[n++] = (struct gpiod_lookup)
+            GPIO_LOOKUP_IDX(gpio_chip, meas_gpios[i], "capture", i, GPIO_ACTIVE_HIGH);
+    if (step_gpio >= 0 && dir_gpio >= 0) {
+        myrt_lookup->table[n++] = (struct gpiod_lookup)
+            GPIO_LOOKUP(gpio_chip, step_gpio, "step", GPIO_ACTIVE_HIGH);
+        myrt_lookup->table[n++] = (struct gpiod_lookup)
+            GPIO_LOOKUP(gpio_chip, dir_gpio, "dir", GPIO_ACTIVE_HIGH);
+    }
+    if (n_hall == N_HALL && n_bldc == N_PHASE_OUT) {
+        for (i = 0; i < N_HALL; i++)
+            myrt_lookup->table[n++] = (struct gpiod_lookup)
+                GPIO_LOOKUP_IDX(gpio_chip, hall_gpios[i], "hall", i, GPIO_ACTIVE_HIGH);
+        for (i = 0; i < N_PHASE_OUT; i++)
+            myrt_lookup->table[n++] = (struct gpiod_lookup)
+                GPIO_LOOKUP_IDX(gpio_chip, bldc_gpios[i], "bldc", i, GPIO_ACTIVE_HIGH);
+    }
+    for (i = 0; i < n_servo; i++)
+        myrt_lookup->table[n++] = (struct gpiod_lookup)
+            GPIO_LOOKUP_IDX(gpio_chip, servo_gpios[i], "servo", i, GPIO_ACTIVE_HIGH);
+    if (estop_gpio >= 0)
+        myrt_lookup->table[n++] = (struct gpiod_lookup)
+            GPIO_LOOKUP(gpio_chip, estop_gpio, "estop", GPIO_ACTIVE_HIGH);
+
+    gpiod_add_lookup_table(myrt_lookup);
+    return 0;
+}
+
+static void myrt_remove_lookup(void)
+{
+    gpiod_remove_lookup_table(myrt_lookup);
+    kfree(myrt_lookup);
+}
+
+static int myrt_add_pin_instance(void)
+{
+    int ret;
+
+    if (n_pwm < 1 || n_pwm > MAX_PWM_CH) {
+        pr_err("myrt: need 1..%d PWM pins\n", MAX_PWM_CH);
+        return -EINVAL;
+    }
+    ret = myrt_add_lookup();
+    if (ret) return ret;
+
+    myrt_pin_pdev = platform_device_register_simple(DEVICE_NAME, 0, NULL, 0);
+    if (IS_ERR(myrt_pin_pdev)) {
+        ret = PTR_ERR(myrt_pin_pdev);
+        myrt_pin_pdev = NULL;
+        myrt_remove_lookup();
+        return ret;
+    }
+    return 0;
+}
+
+// ====== Init & Exit ======
+static int __init myrt_init(void)
+{
+    int ret;
+
+    // char device numbers, one minor per instance
+    ret = alloc_chrdev_region(&myrt_devt, 0, MYRT_MAX_DEVS, DEVICE_NAME);
+    if (ret) {
+        pr_err("failed to register char device\n");
+        return ret;
+    }
+
+    //myrt_class = class_create(THIS_MODULE, CLASS_NAME);
+    myrt_class = class_create(CLASS_NAME);
+    if (IS_ERR(myrt_class)) {
+        pr_err("myrt: failed to create class\n");
+        ret = PTR_ERR(myrt_class);
+        goto err_region;
+    }
+
+    // one family for all instances, MYRT_A_DEV tells them apart
+    ret = myrt_genl_register();
+    if (ret)
+        goto err_class;
+    // the control law type, BPF programs can be loaded against it from now on
+    ret = myrt_bpf_register();
+    if (ret)
+        goto err_genl;
+
+    ret = platform_driver_register(&myrt_driver);
+    if (ret)
+        goto err_genl;
+
+    if (pin_instance) {
+        ret = myrt_add_pin_instance();
+        if (ret)
+            goto err_driver;
+    }
+
+    pr_info("myrt: module loaded\n");
+    return 0;
+
+err_driver:
+    platform_driver_unregister(&myrt_driver);
+err_genl:
+    myrt_genl_unregister();
+err_class:
+    class_destroy(myrt_class);
+err_region:
+    unregister_chrdev_region(myrt_devt, MYRT_MAX_DEVS);
+    return ret;
+}
+
+static void __exit myrt_exit(void)
+{
+    if (myrt_pin_pdev) {
+        platform_device_unregister(myrt_pin_pdev);
+        myrt_remove_lookup();
+    }
+    platform_driver_unregister(&myrt_driver);
+    myrt_genl_unregister();
+    class_destroy(myrt_class);
+    unregister_chrdev_region(myrt_devt, MYRT_MAX_DEVS);
+    pr_info("myrt: module unloaded\n");
+}
+
+module_init(myrt_init);
+module_exit(myrt_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("hu");
+MODULE_DESCRIPTION("RT PWM + GPIO interval driver");
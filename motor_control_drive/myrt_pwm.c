@@ -0,0 +1,126 @@
+// myrt_pwm.c
+// The PWM engine as a pwm_chip, one pwm per PWM channel. .apply stages
+// period, duty and polarity in the core, which takes them over together at
+// the next period start, so a consumer never sees a period with half of an
+// update. All channels share the engine period and duty has 1 % steps.
+
+#include <linux/kernel.h>
+#include <linux/err.h>
+#include <linux/math64.h>
+#include <linux/pwm.h>
+
+#include "myrt.h"
+
+struct myrt_pwm {
+    struct pwm_chip *chip;
+    struct myrt_core *core;
+    // as last applied: a channel enabled at 0 % still reads back enabled
+    unsigned long enabled;
+};
+
+static int myrt_pwm_apply(struct pwm_chip *chip, struct pwm_device *pwm,
+                          const struct pwm_state *state)
+{
+    struct myrt_pwm *mp = pwmchip_get_drvdata(chip);
+    u64 period = min_t(u64, state->period, PWM_PERIOD_MAX_NS);
+    bool inverted = state->polarity == PWM_POLARITY_INVERSED;
+    u32 cur_period;
+    int cur_duty, duty = 0;
+    bool cur_inv;
+    unsigned int i;
+    int ret;
+
+    pwm_get_staged(mp->core, pwm->hwpwm, &cur_period, &cur_duty, &cur_inv);
+    if (!state->enabled) {
+        // inactive level, the period stays whatever the others run at
+        ret = pwm_stage(mp->core, pwm->hwpwm, cur_period, 0, inverted);
+        if (!ret)
+            clear_bit(pwm->hwpwm, &mp->enabled);
+        return ret;
+    }
+
+    if (period < PWM_PERIOD_MIN_NS)
+        return -EINVAL;
+    // the period is shared: only change it when no other channel runs.
+    // That is the engine's view: a channel can run from its probe default
+    // or from /dev/myrtN writes without ever being requested here.
+    if (period != cur_period) {
+        for (i = 0; i < chip->npwm; i++) {
+            u32 other_period;
+            int other_duty;
+            bool other_inv;
+
+            if (i == pwm->hwpwm)
+                continue;
+            pwm_get_staged(mp->core, i, &other_period, &other_duty, &other_inv);
+            if (other_duty > 0 || test_bit(i, &mp->enabled))
+                return -EBUSY;
+        }
+    }
+    // round down, as the PWM core expects
+    duty = div64_u64(min(state->duty_cycle, period) * 100, period);
+    ret = pwm_stage(mp->core, pwm->hwpwm, period, duty, inverted);
+    if (!ret)
+        set_bit(pwm->hwpwm, &mp->enabled);
+    return ret;
+}
+
+static int myrt_pwm_get_state(struct pwm_chip *chip, struct pwm_device *pwm,
+                              struct pwm_state *state)
+{
+    struct myrt_pwm *mp = pwmchip_get_drvdata(chip);
+    u32 period;
+    int duty;
+    bool inverted;
+
+    pwm_get_staged(mp->core, pwm->hwpwm, &period, &duty, &inverted);
+    state->period = period;
+    state->duty_cycle = div_u64((u64)period * duty, 100);
+    state->polarity = inverted ? PWM_POLARITY_INVERSED : PWM_POLARITY_NORMAL;
+    state->enabled = test_bit(pwm->hwpwm, &mp->enabled);
+    return 0;
+}
+
+static const struct pwm_ops myrt_pwm_ops = {
+    .apply     = myrt_pwm_apply,
+    .get_state = myrt_pwm_get_state,
+};
+
+struct myrt_pwm *myrt_pwm_register(struct device *parent, struct myrt_core *core)
+{
+    struct pwm_chip *chip;
+    struct myrt_pwm *mp;
+    unsigned int i;
+    u32 period;
+    int duty, ret;
+    bool inverted;
+
+    chip = pwmchip_alloc(parent, core->n_pwm, sizeof(*mp));
+    if (IS_ERR(chip))
+        return ERR_CAST(chip);
+    mp = pwmchip_get_drvdata(chip);
+    mp->chip = chip;
+    mp->core = core;
+    chip->ops = &myrt_pwm_ops;
+    // the engine runs every channel from probe on, at its default duty
+    for (i = 0; i < core->n_pwm; i++) {
+        pwm_get_staged(core, i, &period, &duty, &inverted);
+        if (duty > 0)
+            set_bit(i, &mp->enabled);
+    }
+
+    ret = pwmchip_add(chip);
+    if (ret) {
+        pwmchip_put(chip);
+        return ERR_PTR(ret);
+    }
+    return mp;
+}
+
+void myrt_pwm_unregister(struct myrt_pwm *mp)
+{
+    struct pwm_chip *chip = mp->chip;
+
+    pwmchip_remove(chip);
+    pwmchip_put(chip);
+}
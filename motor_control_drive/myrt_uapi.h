@@ -0,0 +1,60 @@
+// myrt_uapi.h
+// Generic netlink family "myrt", shared by the module and its listeners
+// (user/myrt_listen.c). Everything is multicast, there are no requests:
+// join a group and read.
+#ifndef MYRT_UAPI_H
+#define MYRT_UAPI_H
+
+#include <linux/types.h>
+
+#define MYRT_GENL_NAME          "myrt"
+#define MYRT_GENL_VERSION       1
+#define MYRT_GENL_MCGRP_ALARMS  "alarms"
+#define MYRT_GENL_MCGRP_SAMPLES "samples"
+
+enum myrt_genl_cmd {
+    MYRT_CMD_UNSPEC,
+    MYRT_CMD_ALARMS,            // one or more MYRT_A_ALARM
+    MYRT_CMD_SAMPLES,           // one or more MYRT_A_SAMPLE
+};
+
+enum myrt_genl_attr {
+    MYRT_A_UNSPEC,
+    MYRT_A_DEV,                 // u32, N of /dev/myrtN
+    MYRT_A_ALARM,               // nested MYRT_AA_*
+    MYRT_A_SAMPLE,              // nested MYRT_AS_*
+    MYRT_A_DROPPED,             // u64, edges lost before this message: overwritten
+                                // in the ring, or their message failed
+    __MYRT_A_MAX,
+};
+#define MYRT_A_MAX (__MYRT_A_MAX - 1)
+
+enum myrt_alarm {
+    MYRT_ALARM_ESTOP,           // value: stop latency, ns
+    MYRT_ALARM_WDT,             // value: deadlines missed so far
+    MYRT_ALARM_OVERRUN,         // value: PWM steps skipped since the last report
+    MYRT_ALARM_STALL,           // value: ns since the channel's last edge
+    MYRT_ALARM_UNLOCK,          // value: |phase error| of the PLL, ns
+};
+
+enum myrt_alarm_attr {
+    MYRT_AA_UNSPEC,
+    MYRT_AA_TYPE,               // u32, enum myrt_alarm
+    MYRT_AA_CH,                 // u32, capture channel (stall only)
+    MYRT_AA_VALUE,              // u64
+    __MYRT_AA_MAX,
+};
+#define MYRT_AA_MAX (__MYRT_AA_MAX - 1)
+
+// one edge of the stream on /dev/myrtN, every decimate-th of them
+enum myrt_sample_attr {
+    MYRT_AS_UNSPEC,
+    MYRT_AS_SEQ,                // u64
+    MYRT_AS_CH,                 // u32
+    MYRT_AS_PERIOD_NS,          // u64
+    MYRT_AS_TS_NS,              // s64, in the instance's clock base
+    __MYRT_AS_MAX,
+};
+#define MYRT_AS_MAX (__MYRT_AS_MAX - 1)
+
+#endif
@@ -0,0 +1,2 @@
+// the system header already has the kernel error numbers
+#include_next <linux/errno.h>
@@ -0,0 +1,215 @@
+// kshim.c
+// Virtual clock, timer queue, mock GPIOs and IRQs behind kshim.h.
+
+#include "kshim.h"
+
+ktime_t kshim_now;
+s64 kshim_latency_ns;
+struct kshim_stats kshim_stats;
+struct gpio_desc kshim_pins[KSHIM_MAX_GPIO];
+
+static struct hrtimer *timers;      // every timer seen by hrtimer_init
+
+static struct {
+    irq_handler_t handler;
+    unsigned long flags;
+    void *dev;
+} irqs[KSHIM_MAX_IRQ];
+
+// ====== hrtimer ======
+void hrtimer_init(struct hrtimer *timer, int clock_id, enum hrtimer_mode mode)
+{
+    struct hrtimer *t;
+
+    timer->queued = false;
+    timer->expires = 0;
+    for (t = timers; t; t = t->next)
+        if (t == timer)
+            return;
+    timer->next = timers;
+    timers = timer;
+}
+
+void hrtimer_start(struct hrtimer *timer, ktime_t tim, enum hrtimer_mode mode)
+{
+    timer->expires = mode == HRTIMER_MODE_REL ? kshim_now + tim : tim;
+    timer->queued = true;
+}
+
+int hrtimer_try_to_cancel(struct hrtimer *timer)
+{
+    int was = timer->queued;
+
+    timer->queued = false;
+    return was;
+}
+
+int hrtimer_cancel(struct hrtimer *timer)
+{
+    return hrtimer_try_to_cancel(timer);
+}
+
+// same rules as kernel/time/hrtimer.c: move expires past now in whole
+// intervals and return how many were needed
+u64 hrtimer_forward(struct hrtimer *timer, ktime_t now, ktime_t interval)
+{
+    s64 delta = now - timer->expires;
+    u64 orun = 1;
+
+    if (delta < 0)
+        return 0;
+    if (delta >= interval) {
+        s64 incr = interval;
+
+        orun = delta / incr;
+        timer->expires += incr * orun;
+        if (timer->expires > now)
+            goto out;
+        orun++;
+    }
+    timer->expires += interval;
+out:
+    kshim_stats.timer_overruns += orun - 1;
+    return orun;
+}
+
+static struct hrtimer *next_due(ktime_t t)
+{
+    struct hrtimer *timer, *best = NULL;
+
+    for (timer = timers; timer; timer = timer->next) {
+        if (!timer->queued || timer->expires > t)
+            continue;
+        if (!best || timer->expires < best->expires)
+            best = timer;
+    }
+    return best;
+}
+
+void kshim_run_until(ktime_t t)
+{
+    struct hrtimer *timer;
+
+    while ((timer = next_due(t))) {
+        ktime_t due = timer->expires + kshim_latency_ns;
+
+        if (due > kshim_now)
+            kshim_now = due;
+        // dequeued while running, as in the kernel, so the callback may restart it
+        timer->queued = false;
+        kshim_stats.timer_calls++;
+        if (timer->function(timer) == HRTIMER_RESTART)
+            timer->queued = true;
+    }
+    if (t > kshim_now)
+        kshim_now = t;
+}
+
+void kshim_reset(void)
+{
+    struct hrtimer *timer;
+
+    for (timer = timers; timer; timer = timer->next)
+        timer->queued = false;
+    timers = NULL;
+    memset(irqs, 0, sizeof(irqs));
+    memset(&kshim_stats, 0, sizeof(kshim_stats));
+    kshim_now = 0;
+    kshim_latency_ns = 0;
+}
+
+// ====== IRQs ======
+int request_irq(unsigned int irq, irq_handler_t handler, unsigned long flags,
+                const char *name, void *dev)
+{
+    if (irq >= KSHIM_MAX_IRQ || irqs[irq].handler)
+        return -16;     // -EBUSY
+    irqs[irq].handler = handler;
+    irqs[irq].flags = flags;
+    irqs[irq].dev = dev;
+    return 0;
+}
+
+void free_irq(unsigned int irq, void *dev)
+{
+    if (irq < KSHIM_MAX_IRQ && irqs[irq].dev == dev)
+        irqs[irq].handler = NULL;
+}
+
+// ====== GPIO ======
+int gpiod_get_value(const struct gpio_desc *desc)
+{
+    return desc->value;
+}
+
+void gpiod_set_value(struct gpio_desc *desc, int value)
+{
+    desc->value = !!value;
+    kshim_stats.gpio_writes++;
+}
+
+int gpiod_get_array_value(unsigned int array_size, struct gpio_desc **desc_array,
+                          struct gpio_array *array_info, unsigned long *value_bitmap)
+{
+    unsigned int i;
+
+    *value_bitmap = 0;
+    for (i = 0; i < array_size; i++)
+        if (desc_array[i]->value)
+            *value_bitmap |= BIT(i);
+    return 0;
+}
+
+int gpiod_set_array_value(unsigned int array_size, struct gpio_desc **desc_array,
+                          struct gpio_array *array_info, unsigned long *value_bitmap)
+{
+    unsigned int i;
+
+    for (i = 0; i < array_size; i++)
+        desc_array[i]->value = !!(*value_bitmap & BIT(i));
+    kshim_stats.array_writes++;
+    return 0;
+}
+
+int gpiod_to_irq(const struct gpio_desc *desc)
+{
+    return desc->irq;
+}
+
+struct gpio_descs *kshim_gpio_descs_alloc(unsigned int n, int first_irq)
+{
+    struct gpio_descs *descs;
+    unsigned int i;
+
+    descs = calloc(1, sizeof(*descs) + n * sizeof(descs->desc[0]));
+    descs->ndescs = n;
+    for (i = 0; i < n; i++) {
+        descs->desc[i] = calloc(1, sizeof(struct gpio_desc));
+        descs->desc[i]->irq = first_irq < 0 ? -1 : first_irq + (int)i;
+    }
+    return descs;
+}
+
+void kshim_gpio_descs_free(struct gpio_descs *descs)
+{
+    unsigned int i;
+
+    for (i = 0; i < descs->ndescs; i++)
+        free(descs->desc[i]);
+    free(descs);
+}
+
+void kshim_gpio_set_input(struct gpio_desc *desc, int value)
+{
+    int old = desc->value;
+    unsigned long trig;
+
+    desc->value = !!value;
+    if (desc->irq < 0 || desc->irq >= KSHIM_MAX_IRQ || !irqs[desc->irq].handler)
+        return;
+    trig = desc->value ? IRQF_TRIGGER_RISING : IRQF_TRIGGER_FALLING;
+    if (old != desc->value && (irqs[desc->irq].flags & trig)) {
+        kshim_stats.irqs++;
+        irqs[desc->irq].handler(desc->irq, irqs[desc->irq].dev);
+    }
+}
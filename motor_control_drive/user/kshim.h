@@ -0,0 +1,227 @@
+// kshim.h
+// Just enough of the kernel API for myrt_core.c to build as a userspace
+// library. Time is virtual: ktime_get() returns kshim_now, which only moves
+// when kshim_run_until() fires the queued hrtimers in expiry order, so a run
+// gives the same result on every machine. GPIOs are plain memory, IRQs are
+// handlers called straight from kshim_gpio_set_input().
+#ifndef KSHIM_H
+#define KSHIM_H
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+#define U32_MAX                 ((u32)~0U)
+typedef uint64_t u64;
+typedef int8_t   s8;
+typedef int16_t  s16;
+typedef int32_t  s32;
+typedef int64_t  s64;
+
+// ====== Helpers from kernel.h / compiler.h ======
+#define READ_ONCE(x)            (*(const volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, v)        (*(volatile __typeof__(x) *)&(x) = (v))
+#define smp_load_acquire(p)     __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define container_of(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define BIT(n)                  (1UL << (n))
+#define BITS_PER_LONG           (8 * (int)sizeof(long))
+#define for_each_set_bit(bit, addr, size) \
+    for ((bit) = 0; (bit) < (size); (bit)++) \
+        if (*(addr) & BIT(bit))
+
+#define min(a, b)               ((a) < (b) ? (a) : (b))
+#define max(a, b)               ((a) > (b) ? (a) : (b))
+#define min_t(t, a, b)          min((t)(a), (t)(b))
+#define max_t(t, a, b)          max((t)(a), (t)(b))
+#define clamp(v, lo, hi)        min(max(v, lo), hi)
+#define clamp_t(t, v, lo, hi)   clamp((t)(v), (t)(lo), (t)(hi))
+#define DIV_ROUND_CLOSEST(x, d) \
+    (((x) > 0) == ((d) > 0) ? ((x) + (d) / 2) / (d) : ((x) - (d) / 2) / (d))
+
+#define pr_info(...)            printf(__VA_ARGS__)
+#define pr_warn(...)            fprintf(stderr, __VA_ARGS__)
+#define pr_err(...)             fprintf(stderr, __VA_ARGS__)
+
+// ====== spinlock.h, single-threaded here ======
+typedef struct { int locked; } spinlock_t;
+
+#define spin_lock_init(l)               ((l)->locked = 0)
+#define spin_lock(l)                    ((l)->locked = 1)
+#define spin_unlock(l)                  ((l)->locked = 0)
+#define spin_lock_irqsave(l, flags)     ((flags) = 0, spin_lock(l))
+#define spin_unlock_irqrestore(l, flags) ((void)(flags), spin_unlock(l))
+
+typedef spinlock_t raw_spinlock_t;
+
+#define raw_spin_lock_init(l)               spin_lock_init(l)
+#define raw_spin_lock(l)                    spin_lock(l)
+#define raw_spin_unlock(l)                  spin_unlock(l)
+#define raw_spin_lock_irqsave(l, flags)     spin_lock_irqsave(l, flags)
+#define raw_spin_unlock_irqrestore(l, flags) spin_unlock_irqrestore(l, flags)
+
+// ====== seqlock.h, a reader never overlaps a writer here ======
+typedef struct { unsigned int sequence; } seqcount_raw_spinlock_t;
+
+#define seqcount_raw_spinlock_init(s, l)    ((s)->sequence = 0, (void)(l))
+#define write_seqcount_begin(s)             ((s)->sequence++)
+#define write_seqcount_end(s)               ((s)->sequence++)
+#define read_seqcount_begin(s)              ((s)->sequence)
+#define read_seqcount_retry(s, start)       ((s)->sequence != (start))
+
+// ====== kfifo.h, fixed size, the element count a power of two ======
+#define DECLARE_KFIFO(name, type, size) \
+    struct { unsigned int in, out; type buf[size]; } name
+#define INIT_KFIFO(f)           ((f).in = (f).out = 0)
+#define kfifo_size(f)           (sizeof((f)->buf) / sizeof((f)->buf[0]))
+#define kfifo_put(f, v) \
+    ((f)->in - (f)->out < kfifo_size(f) ? \
+     ((f)->buf[(f)->in++ & (kfifo_size(f) - 1)] = (v), 1) : 0)
+#define kfifo_get(f, v) \
+    ((f)->in != (f)->out ? \
+     (*(v) = (f)->buf[(f)->out++ & (kfifo_size(f) - 1)], 1) : 0)
+
+// ====== math64.h ======
+#define NSEC_PER_USEC   1000L
+#define NSEC_PER_SEC    1000000000L
+
+static inline s64 div_s64_rem(s64 dividend, s32 divisor, s32 *remainder)
+{
+    *remainder = dividend % divisor;
+    return dividend / divisor;
+}
+static inline u64 div_u64_rem(u64 dividend, u32 divisor, u32 *remainder)
+{
+    *remainder = dividend % divisor;
+    return dividend / divisor;
+}
+static inline u64 div_u64(u64 dividend, u32 divisor) { return dividend / divisor; }
+static inline u64 div64_u64(u64 dividend, u64 divisor) { return dividend / divisor; }
+static inline s64 div_s64(s64 dividend, s32 divisor) { return dividend / divisor; }
+
+// ====== ktime.h, on the virtual clock ======
+typedef s64 ktime_t;
+
+extern ktime_t kshim_now;
+
+static inline ktime_t ktime_get(void) { return kshim_now; }
+static inline ktime_t ktime_set(s64 secs, unsigned long nsecs) { return secs * NSEC_PER_SEC + nsecs; }
+static inline ktime_t ns_to_ktime(u64 ns) { return ns; }
+static inline s64 ktime_to_ns(ktime_t kt) { return kt; }
+static inline s64 ktime_to_us(ktime_t kt) { return kt / NSEC_PER_USEC; }
+static inline ktime_t ktime_sub(ktime_t a, ktime_t b) { return a - b; }
+static inline ktime_t ktime_add(ktime_t a, ktime_t b) { return a + b; }
+static inline ktime_t ktime_add_ns(ktime_t kt, u64 ns) { return kt + ns; }
+static inline ktime_t ktime_add_us(ktime_t kt, u64 us) { return kt + us * NSEC_PER_USEC; }
+static inline s64 ktime_us_delta(ktime_t later, ktime_t earlier) { return ktime_to_us(later - earlier); }
+static inline int ktime_compare(ktime_t a, ktime_t b) { return a < b ? -1 : a > b; }
+
+// ====== hrtimer.h ======
+enum hrtimer_restart { HRTIMER_NORESTART, HRTIMER_RESTART };
+enum hrtimer_mode { HRTIMER_MODE_ABS, HRTIMER_MODE_REL };
+#define CLOCK_MONOTONIC 1
+
+struct hrtimer {
+    ktime_t expires;
+    enum hrtimer_restart (*function)(struct hrtimer *);
+    bool queued;
+    struct hrtimer *next;       // kshim's list of all initialised timers
+};
+
+void hrtimer_init(struct hrtimer *timer, int clock_id, enum hrtimer_mode mode);
+void hrtimer_start(struct hrtimer *timer, ktime_t tim, enum hrtimer_mode mode);
+int hrtimer_cancel(struct hrtimer *timer);
+int hrtimer_try_to_cancel(struct hrtimer *timer);
+u64 hrtimer_forward(struct hrtimer *timer, ktime_t now, ktime_t interval);
+
+static inline u64 hrtimer_forward_now(struct hrtimer *timer, ktime_t interval)
+{
+    return hrtimer_forward(timer, kshim_now, interval);
+}
+static inline ktime_t hrtimer_get_expires(const struct hrtimer *timer) { return timer->expires; }
+static inline void hrtimer_set_expires(struct hrtimer *timer, ktime_t time) { timer->expires = time; }
+static inline void hrtimer_add_expires_ns(struct hrtimer *timer, u64 ns) { timer->expires += ns; }
+static inline bool hrtimer_active(const struct hrtimer *timer) { return timer->queued; }
+
+// ====== interrupt.h ======
+typedef enum { IRQ_NONE, IRQ_HANDLED, IRQ_WAKE_THREAD } irqreturn_t;
+typedef irqreturn_t (*irq_handler_t)(int, void *);
+
+#define IRQF_TRIGGER_RISING     0x01
+#define IRQF_TRIGGER_FALLING    0x02
+#define IRQF_ONESHOT            0x2000
+#define KSHIM_MAX_IRQ           64
+
+int request_irq(unsigned int irq, irq_handler_t handler, unsigned long flags,
+                const char *name, void *dev);
+void free_irq(unsigned int irq, void *dev);
+
+// ====== gpio/consumer.h ======
+struct gpio_desc {
+    int value;
+    int irq;                    // -1 = no IRQ
+};
+
+struct gpio_array;
+
+struct gpio_descs {
+    struct gpio_array *info;
+    unsigned int ndescs;
+    struct gpio_desc *desc[];
+};
+
+int gpiod_get_value(const struct gpio_desc *desc);
+void gpiod_set_value(struct gpio_desc *desc, int value);
+int gpiod_get_array_value(unsigned int array_size, struct gpio_desc **desc_array,
+                          struct gpio_array *array_info, unsigned long *value_bitmap);
+int gpiod_set_array_value(unsigned int array_size, struct gpio_desc **desc_array,
+                          struct gpio_array *array_info, unsigned long *value_bitmap);
+static inline int gpiod_set_array_value_cansleep(unsigned int array_size,
+                                                 struct gpio_desc **desc_array,
+                                                 struct gpio_array *array_info,
+                                                 unsigned long *value_bitmap)
+{
+    return gpiod_set_array_value(array_size, desc_array, array_info, value_bitmap);
+}
+int gpiod_to_irq(const struct gpio_desc *desc);
+
+// ====== gpio.h, legacy numbers index kshim_pins ======
+#define KSHIM_MAX_GPIO  64
+extern struct gpio_desc kshim_pins[KSHIM_MAX_GPIO];
+
+static inline int gpio_get_value(unsigned int gpio) { return gpiod_get_value(&kshim_pins[gpio]); }
+static inline void gpio_set_value(unsigned int gpio, int value) { gpiod_set_value(&kshim_pins[gpio], value); }
+static inline int gpio_to_irq(unsigned int gpio) { return gpiod_to_irq(&kshim_pins[gpio]); }
+
+// ====== Test harness side ======
+struct kshim_stats {
+    u64 timer_calls;            // hrtimer callbacks run
+    u64 timer_overruns;         // periods skipped by hrtimer_forward
+    u64 gpio_writes;            // gpiod_set_value calls
+    u64 array_writes;           // gpiod_set_array_value calls
+    u64 irqs;                   // handlers called
+};
+extern struct kshim_stats kshim_stats;
+
+// added to kshim_now before every timer callback, models wakeup latency
+extern s64 kshim_latency_ns;
+
+// n descriptors, IRQ numbers first_irq.. (-1 = none), all low
+struct gpio_descs *kshim_gpio_descs_alloc(unsigned int n, int first_irq);
+void kshim_gpio_descs_free(struct gpio_descs *descs);
+// drive an input; a rising/falling edge calls the matching IRQ handler
+void kshim_gpio_set_input(struct gpio_desc *desc, int value);
+// fire every timer due up to t in expiry order, then leave the clock at t
+void kshim_run_until(ktime_t t);
+void kshim_reset(void);
+
+#endif
@@ -0,0 +1,246 @@
+// myrt_bench.c
+// Runs the myrt core against kshim: first a fixed stretch of virtual time
+// with the PLL tracking an off-frequency reference, whose results are the
+// same on every machine, then host timings of the two hot paths.
+// Build: make    Run: ./myrt_bench [seconds] [ref_offset_ns] [latency_ns]
+
+#include <time.h>
+
+#include "kshim.h"
+#include "myrt_core.h"
+
+#define N_PWM   4
+#define N_MEAS  2
+
+static struct myrt_core core;
+static struct hrtimer ref_timer;
+static s64 ref_period_ns;
+
+// reference signal on MEAS_IN 0: 10 us high pulse every ref_period_ns
+static enum hrtimer_restart ref_timer_callback(struct hrtimer *timer)
+{
+    struct gpio_desc *in = core.meas_gpios->desc[0];
+
+    if (!in->value) {
+        kshim_gpio_set_input(in, 1);
+        hrtimer_add_expires_ns(timer, 10000);
+    } else {
+        kshim_gpio_set_input(in, 0);
+        hrtimer_add_expires_ns(timer, ref_period_ns - 10000);
+    }
+    return HRTIMER_RESTART;
+}
+
+static double host_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void setup(void)
+{
+    unsigned int ch;
+    int ret;
+
+    kshim_reset();
+    memset(&core, 0, sizeof(core));
+    core.pwm_gpios = kshim_gpio_descs_alloc(N_PWM, -1);
+    core.meas_gpios = kshim_gpio_descs_alloc(N_MEAS, 0);
+    core.n_pwm = N_PWM;
+    core.n_meas = N_MEAS;
+    myrt_core_init(&core);
+    for (ch = 0; ch < N_PWM; ch++)
+        pwm_set_duty(&core, ch, 10 + 25 * ch);
+    for (ch = 0; ch < N_MEAS; ch++) {
+        core.caps[ch].irq = gpiod_to_irq(core.meas_gpios->desc[ch]);
+        ret = request_irq(core.caps[ch].irq, gpio_irq_handler,
+                          IRQF_TRIGGER_RISING, "myrt_gpio_irq", &core.caps[ch]);
+        if (ret) {
+            fprintf(stderr, "request_irq %d failed\n", ch);
+            exit(1);
+        }
+    }
+}
+
+static void teardown(void)
+{
+    myrt_core_stop(&core);
+    kshim_gpio_descs_free(core.pwm_gpios);
+    kshim_gpio_descs_free(core.meas_gpios);
+}
+
+// virtual-time run, deterministic
+static void run_pll(double seconds, s64 offset_ns, s64 latency_ns)
+{
+    ktime_t end = (ktime_t)(seconds * NSEC_PER_SEC);
+    struct capture_stats st;
+    double t0, t1;
+
+    setup();
+    core.pll.kp_shift = 1;
+    core.pll.ki_shift = 4;
+    core.pll.lock_ns = 5000;
+    pll_set_enabled(&core, true);
+    ref_period_ns = PWM_PERIOD_NS + offset_ns;
+    hrtimer_init(&ref_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    ref_timer.function = ref_timer_callback;
+    hrtimer_start(&ref_timer, 250000, HRTIMER_MODE_ABS);   // quarter period off
+    myrt_core_start(&core);
+    kshim_latency_ns = latency_ns;
+
+    t0 = host_ns();
+    kshim_run_until(end);
+    t1 = host_ns();
+
+    printf("virtual run: %.1f s, reference %lld ns (offset %+lld), wakeup latency %lld ns\n",
+           seconds, (long long)ref_period_ns, (long long)offset_ns, (long long)latency_ns);
+    printf("  pll locked        %d\n", core.pll.locked);
+    printf("  phase error       %lld ns\n", (long long)core.pll.phase_err_ns);
+    printf("  freq correction   %lld ns/period\n", (long long)core.pll.i_corr_ns);
+    capture_snapshot(&core.caps[0], &st);
+    printf("  period_ns ch0     %llu\n", (unsigned long long)st.period_ns);
+    printf("  edges ch0         %llu (rejected %llu)\n",
+           (unsigned long long)st.edges, (unsigned long long)st.rejected);
+    printf("  ts error est ch0  %u ns\n", st.ts_err_ns);
+    printf("  timer callbacks   %llu, PWM steps skipped %llu\n",
+           (unsigned long long)kshim_stats.timer_calls,
+           (unsigned long long)core.overruns);
+    printf("  PWM array writes  %llu (%.2f per period)\n",
+           (unsigned long long)kshim_stats.array_writes,
+           (double)kshim_stats.array_writes * PWM_PERIOD_NS / end);
+    printf("  host time         %.1f ms\n", (t1 - t0) / 1e6);
+    hrtimer_cancel(&ref_timer);
+    teardown();
+}
+
+// reference clock of run_align: off by ref_offs_ns, running ref_ppb fast
+static s64 ref_offs_ns;
+static s64 ref_ppb;
+static struct hrtimer step_timer;
+
+static ktime_t ref_clock(struct myrt_core *c, ktime_t mono)
+{
+    return mono + ref_offs_ns + mono / 1000 * ref_ppb / 1000000;
+}
+
+// the reference clock is stepped once, halfway through
+static enum hrtimer_restart step_timer_callback(struct hrtimer *timer)
+{
+    ref_offs_ns += 123456;
+    return HRTIMER_NORESTART;
+}
+
+// virtual-time run of the period alignment to a clock (CLOCK_TAI in the
+// module) that is offset, drifts and gets stepped
+static void run_align(double seconds, s64 ppb)
+{
+    ktime_t end = (ktime_t)(seconds * NSEC_PER_SEC);
+    s32 phase;
+
+    setup();
+    core.pll.kp_shift = 1;
+    core.pll.ki_shift = 4;
+    core.pll.lock_ns = 5000;
+    core.pll_ref_clock = ref_clock;
+    ref_offs_ns = 37000000123LL;
+    ref_ppb = ppb;
+    pll_align_clock(&core, 0);
+    hrtimer_init(&step_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    step_timer.function = step_timer_callback;
+    hrtimer_start(&step_timer, end / 2, HRTIMER_MODE_ABS);
+    myrt_core_start(&core);
+    kshim_run_until(end);
+
+    div_s64_rem(ktime_to_ns(ref_clock(&core, core.period_start)), core.period_ns,
+                &phase);
+    printf("virtual run: %.1f s, aligned to a clock %+lld ppb off, stepped once\n",
+           seconds, (long long)ppb);
+    printf("  pll locked        %d\n", core.pll.locked);
+    printf("  phase error       %lld ns (max %lld)\n", (long long)core.pll.phase_err_ns,
+           (long long)core.pll.phase_err_max_ns);
+    printf("  period start      %lld ns past a multiple\n", (long long)phase);
+    printf("  freq correction   %lld ns/period\n", (long long)core.pll.i_corr_ns);
+    printf("  jumps             %llu\n", (unsigned long long)core.pll.jumps);
+    hrtimer_cancel(&step_timer);
+    core.pll_ref_clock = NULL;
+    pll_set_enabled(&core, false);
+    teardown();
+}
+
+static void kick_nop(struct myrt_core *c) { }
+
+// host cost of one PWM step and one capture edge, simulator overhead included
+static void run_hot_paths(long iters)
+{
+    struct hrtimer *timer = &core.pwm_timer;
+    struct capture_chan *cap;
+    struct capture_raw raw;
+    double t0, t1;
+    long i;
+
+    setup();
+    pll_set_enabled(&core, true);
+    t0 = host_ns();
+    for (i = 0; i < iters; i++) {
+        kshim_now += PWM_STEP_NS;
+        timer->function(timer);
+    }
+    t1 = host_ns();
+    printf("pwm_timer_callback  %.1f ns/call\n", (t1 - t0) / iters);
+
+    cap = &core.caps[1];
+    t0 = host_ns();
+    for (i = 0; i < iters; i++) {
+        kshim_now += PWM_PERIOD_NS;
+        gpio_irq_handler(cap->irq, cap);
+    }
+    t1 = host_ns();
+    printf("gpio_irq_handler    %.1f ns/call\n", (t1 - t0) / iters);
+
+    capture_set_deglitch(cap, 2 * PWM_PERIOD_NS, 0);
+    t0 = host_ns();
+    for (i = 0; i < iters; i++) {
+        kshim_now += PWM_PERIOD_NS;
+        gpio_irq_handler(cap->irq, cap);
+    }
+    t1 = host_ns();
+    printf("  rejected edge     %.1f ns/call\n", (t1 - t0) / iters);
+
+    // deferred: the IRQ only queues, the drain runs the rest per batch
+    capture_set_deglitch(cap, 0, 0);
+    core.capture_kick = kick_nop;
+    t0 = host_ns();
+    for (i = 0; i < iters; i++) {
+        kshim_now += PWM_PERIOD_NS;
+        gpio_irq_handler(cap->irq, cap);
+        if ((i & (CAPTURE_QUEUE_LEN - 1)) == CAPTURE_QUEUE_LEN - 1)
+            capture_drain(&core);
+    }
+    t1 = host_ns();
+    printf("  deferred, total   %.1f ns/edge (lost %llu)\n", (t1 - t0) / iters,
+           (unsigned long long)cap->queue_lost);
+    t0 = host_ns();
+    for (i = 0; i < iters; i++) {
+        kshim_now += PWM_PERIOD_NS;
+        gpio_irq_handler(cap->irq, cap);
+        kfifo_get(&cap->queue, &raw);
+    }
+    t1 = host_ns();
+    printf("  deferred, IRQ     %.1f ns/call\n", (t1 - t0) / iters);
+    core.capture_kick = NULL;
+    teardown();
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 2.0;
+    s64 offset_ns = argc > 2 ? atoll(argv[2]) : 300;
+    s64 latency_ns = argc > 3 ? atoll(argv[3]) : 0;
+
+    run_pll(seconds, offset_ns, latency_ns);
+    run_align(seconds, 20000);
+    run_hot_paths(10000000);
+    return 0;
+}
@@ -0,0 +1,96 @@
+// myrt_ctl_pi.bpf.c
+// Example control law for myrt (struct myrt_ctl_ops, myrt_bpf.c): PI speed
+// control of a motor whose tachometer is on a capture channel. The setpoint
+// is the wanted period in ns; a measured period longer than that (too
+// slow) raises the duty. Runs on every tachometer edge.
+// Build and load (clang, libbpf headers, bpftool; myrt loaded):
+//   make myrt_ctl_pi.bpf.o
+//   sudo bpftool struct_ops register myrt_ctl_pi.bpf.o
+//   echo "ctl 0 0 1000000" | sudo tee /dev/myrt0      (1 kHz on capture 0)
+// Unload: sudo bpftool struct_ops unregister name myrt_pi
+
+#include <linux/types.h>
+#include <linux/bpf.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+
+char LICENSE[] SEC("license") = "GPL";
+
+// as in myrt.h; libbpf finds the module's types by name and field names
+struct myrt_ctl_state {
+    __u32 dev;
+    __u32 in_ch;
+    __u32 out_ch;
+    __s32 duty;
+    __u64 seq;
+    __u64 period_ns;
+    __s64 ts_ns;
+    __u64 setpoint;
+    __u32 pwm_period_ns;
+} __attribute__((preserve_access_index));
+
+struct myrt_ctl_ops {
+    int (*step)(struct myrt_ctl_state *st);
+    char name[16];
+};
+
+#define MYRT_MAX_DEVS   16
+#define KP_DIV          10      // 1 duty point per 1 % of period error
+#define KI_SHIFT        8       // I part: 1/256 duty point per 0.1 % and edge
+#define INTEG_MAX       (100 << KI_SHIFT)
+
+// integrator of every instance, duty points << KI_SHIFT
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, MYRT_MAX_DEVS);
+    __type(key, __u32);
+    __type(value, __s64);
+} integ SEC(".maps");
+
+// (period - setpoint) / setpoint in 0.1 %, without signed division
+static __s64 err_permille(__u64 period, __u64 setpoint)
+{
+    if (period >= setpoint)
+        return (__s64)((period - setpoint) * 1000 / setpoint);
+    return -(__s64)((setpoint - period) * 1000 / setpoint);
+}
+
+SEC("struct_ops/myrt_pi_step")
+int BPF_PROG(myrt_pi_step, struct myrt_ctl_state *st)
+{
+    __u32 dev = st->dev;
+    __s64 e, p, duty, *i;
+
+    // the first edge has no period yet
+    if (!st->period_ns || !st->setpoint)
+        return -1;
+    i = bpf_map_lookup_elem(&integ, &dev);
+    if (!i)
+        return -1;
+
+    e = err_permille(st->period_ns, st->setpoint);
+    // a stalled motor gives huge errors, keep them from winding up the sum
+    if (e > 1000)
+        e = 1000;
+    else if (e < -1000)
+        e = -1000;
+    *i += e;
+    if (*i > INTEG_MAX)
+        *i = INTEG_MAX;
+    else if (*i < 0)
+        *i = 0;
+
+    p = e >= 0 ? e / KP_DIV : -(-e / KP_DIV);
+    duty = (*i >> KI_SHIFT) + p;
+    if (duty > 100)
+        duty = 100;
+    else if (duty < 0)
+        duty = 0;
+    return duty;
+}
+
+SEC(".struct_ops")
+struct myrt_ctl_ops myrt_pi = {
+    .step = (void *)myrt_pi_step,
+    .name = "pi",
+};
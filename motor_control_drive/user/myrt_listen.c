@@ -0,0 +1,197 @@
+// myrt_listen.c
+// Prints what the "myrt" generic netlink family multicasts (myrt_uapi.h):
+// alarms, and with -s the decimated capture samples as well. Plain netlink
+// sockets, no libnl.
+// Build: make myrt_listen    Run: ./myrt_listen [-s]
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+
+#include "myrt_uapi.h"
+
+#define BUF_LEN 16384
+
+static const char *alarm_names[] = {
+    [MYRT_ALARM_ESTOP]   = "estop",
+    [MYRT_ALARM_WDT]     = "wdt",
+    [MYRT_ALARM_OVERRUN] = "overrun",
+    [MYRT_ALARM_STALL]   = "stall",
+    [MYRT_ALARM_UNLOCK]  = "unlock",
+};
+
+static void die(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+#define NLA_OK(a, len)  ((len) >= (int)sizeof(struct nlattr) && \
+                         (a)->nla_len >= sizeof(struct nlattr) && (a)->nla_len <= (len))
+#define NLA_NEXT(a, len) ((len) -= NLA_ALIGN((a)->nla_len), \
+                          (struct nlattr *)((char *)(a) + NLA_ALIGN((a)->nla_len)))
+#define NLA_DATA(a)     ((void *)((char *)(a) + NLA_HDRLEN))
+#define NLA_LEN(a)      ((int)(a)->nla_len - NLA_HDRLEN)
+
+// attributes of one level by type, later duplicates win
+static void parse(struct nlattr **tb, int max, struct nlattr *a, int len)
+{
+    memset(tb, 0, sizeof(*tb) * (max + 1));
+    for (; NLA_OK(a, len); a = NLA_NEXT(a, len)) {
+        int type = a->nla_type & NLA_TYPE_MASK;
+
+        if (type <= max)
+            tb[type] = a;
+    }
+}
+
+static unsigned long long get_u64(struct nlattr *a)
+{
+    unsigned long long v;
+
+    memcpy(&v, NLA_DATA(a), sizeof(v));
+    return v;
+}
+
+static unsigned int get_u32(struct nlattr *a)
+{
+    return *(unsigned int *)NLA_DATA(a);
+}
+
+// Family id and the ids of its multicast groups from nlctrl
+static int resolve(int fd, int *alarms, int *samples)
+{
+    struct {
+        struct nlmsghdr n;
+        struct genlmsghdr g;
+        char buf[64];
+    } req = {
+        .n = { .nlmsg_type = GENL_ID_CTRL, .nlmsg_flags = NLM_F_REQUEST },
+        .g = { .cmd = CTRL_CMD_GETFAMILY, .version = 1 },
+    };
+    struct nlattr *a = (struct nlattr *)req.buf, *tb[CTRL_ATTR_MAX + 1];
+    struct nlattr *grp, *gtb[CTRL_ATTR_MCAST_GRP_MAX + 1];
+    static char buf[BUF_LEN];
+    struct nlmsghdr *n = (struct nlmsghdr *)buf;
+    int len, glen, family;
+
+    a->nla_type = CTRL_ATTR_FAMILY_NAME;
+    a->nla_len = NLA_HDRLEN + sizeof(MYRT_GENL_NAME);
+    memcpy(NLA_DATA(a), MYRT_GENL_NAME, sizeof(MYRT_GENL_NAME));
+    req.n.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN + NLA_ALIGN(a->nla_len));
+    if (send(fd, &req, req.n.nlmsg_len, 0) < 0)
+        die("send");
+    len = recv(fd, buf, sizeof(buf), 0);
+    if (len < 0)
+        die("recv");
+    if (n->nlmsg_type == NLMSG_ERROR) {
+        fprintf(stderr, "no \"%s\" family, is myrt loaded?\n", MYRT_GENL_NAME);
+        exit(1);
+    }
+
+    len = n->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+    parse(tb, CTRL_ATTR_MAX, (struct nlattr *)((char *)NLMSG_DATA(n) + GENL_HDRLEN), len);
+    if (!tb[CTRL_ATTR_FAMILY_ID] || !tb[CTRL_ATTR_MCAST_GROUPS])
+        return -1;
+    family = *(unsigned short *)NLA_DATA(tb[CTRL_ATTR_FAMILY_ID]);
+
+    glen = NLA_LEN(tb[CTRL_ATTR_MCAST_GROUPS]);
+    for (grp = NLA_DATA(tb[CTRL_ATTR_MCAST_GROUPS]); NLA_OK(grp, glen);
+         grp = NLA_NEXT(grp, glen)) {
+        parse(gtb, CTRL_ATTR_MCAST_GRP_MAX, NLA_DATA(grp), NLA_LEN(grp));
+        if (!gtb[CTRL_ATTR_MCAST_GRP_NAME] || !gtb[CTRL_ATTR_MCAST_GRP_ID])
+            continue;
+        if (!strcmp(NLA_DATA(gtb[CTRL_ATTR_MCAST_GRP_NAME]), MYRT_GENL_MCGRP_ALARMS))
+            *alarms = get_u32(gtb[CTRL_ATTR_MCAST_GRP_ID]);
+        else if (!strcmp(NLA_DATA(gtb[CTRL_ATTR_MCAST_GRP_NAME]), MYRT_GENL_MCGRP_SAMPLES))
+            *samples = get_u32(gtb[CTRL_ATTR_MCAST_GRP_ID]);
+    }
+    return family;
+}
+
+static void print_msg(struct nlmsghdr *n)
+{
+    struct genlmsghdr *g = NLMSG_DATA(n);
+    struct nlattr *a, *tb[MYRT_A_MAX + 1], *sub[MYRT_AA_MAX + MYRT_AS_MAX + 1];
+    int len = n->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+    unsigned int dev;
+
+    parse(tb, MYRT_A_MAX, (struct nlattr *)((char *)g + GENL_HDRLEN), len);
+    dev = tb[MYRT_A_DEV] ? get_u32(tb[MYRT_A_DEV]) : 0;
+    if (tb[MYRT_A_DROPPED])
+        printf("myrt%u dropped %llu\n", dev, get_u64(tb[MYRT_A_DROPPED]));
+
+    // the nested entries repeat, walk them in order
+    a = (struct nlattr *)((char *)g + GENL_HDRLEN);
+    for (; NLA_OK(a, len); a = NLA_NEXT(a, len)) {
+        int type = a->nla_type & NLA_TYPE_MASK;
+
+        if (type == MYRT_A_ALARM) {
+            unsigned int t;
+
+            parse(sub, MYRT_AA_MAX, NLA_DATA(a), NLA_LEN(a));
+            if (!sub[MYRT_AA_TYPE] || !sub[MYRT_AA_VALUE])
+                continue;
+            t = get_u32(sub[MYRT_AA_TYPE]);
+            printf("myrt%u alarm %s", dev,
+                   t < sizeof(alarm_names) / sizeof(alarm_names[0]) ? alarm_names[t] : "?");
+            if (sub[MYRT_AA_CH])
+                printf(" ch %u", get_u32(sub[MYRT_AA_CH]));
+            printf(" %llu\n", get_u64(sub[MYRT_AA_VALUE]));
+        } else if (type == MYRT_A_SAMPLE) {
+            parse(sub, MYRT_AS_MAX, NLA_DATA(a), NLA_LEN(a));
+            if (!sub[MYRT_AS_SEQ] || !sub[MYRT_AS_CH] ||
+                !sub[MYRT_AS_PERIOD_NS] || !sub[MYRT_AS_TS_NS])
+                continue;
+            printf("myrt%u %llu %u %llu %lld\n", dev, get_u64(sub[MYRT_AS_SEQ]),
+                   get_u32(sub[MYRT_AS_CH]), get_u64(sub[MYRT_AS_PERIOD_NS]),
+                   (long long)get_u64(sub[MYRT_AS_TS_NS]));
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_nl sa = { .nl_family = AF_NETLINK };
+    int want_samples = argc > 1 && !strcmp(argv[1], "-s");
+    int fd, family, alarms = -1, samples = -1, len;
+    static char buf[BUF_LEN];
+    struct nlmsghdr *n;
+
+    fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_GENERIC);
+    if (fd < 0)
+        die("socket");
+    if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+        die("bind");
+    family = resolve(fd, &alarms, &samples);
+    if (family < 0 || alarms < 0 || samples < 0) {
+        fprintf(stderr, "incomplete \"%s\" family\n", MYRT_GENL_NAME);
+        return 1;
+    }
+    if (setsockopt(fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &alarms, sizeof(alarms)) < 0)
+        die("join alarms");
+    if (want_samples &&
+        setsockopt(fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &samples, sizeof(samples)) < 0)
+        die("join samples");
+
+    for (;;) {
+        len = recv(fd, buf, sizeof(buf), 0);
+        if (len < 0) {
+            // socket buffer overrun: some messages are lost, keep going
+            if (errno == ENOBUFS) {
+                fprintf(stderr, "overrun\n");
+                continue;
+            }
+            die("recv");
+        }
+        for (n = (struct nlmsghdr *)buf; NLMSG_OK(n, len); n = NLMSG_NEXT(n, len)) {
+            if (n->nlmsg_type == family)
+                print_msg(n);
+        }
+    }
+}
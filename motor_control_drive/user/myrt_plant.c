@@ -0,0 +1,296 @@
+// myrt_plant.c
+// Closed-loop speed control of the simulated DC motor in plant.[ch]: a PI
+// loop reads the tach period the myrt capture measured and sets the PWM
+// duty; the plant follows the PWM output and drives the capture input.
+//
+//   ./myrt_plant sim [rpm] [latency_ns] [out.csv]
+//       core and plant in virtual time, same result on every machine
+//   sudo ./myrt_plant gpio-sim <sim_chip_dir> <pwm_line> <meas_line> [rpm] [out.csv]
+//       myrt loaded on gpio-sim (see loopback_test/), plant in real time
+//
+// The setpoint steps from 0 to rpm at 0.2 s; the run lasts 1.5 s. CSV
+// columns: t_ms,setpoint_rpm,speed_rpm,measured_rpm,duty.
+
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kshim.h"
+#include "myrt_core.h"
+#include "plant.h"
+
+#define RUN_NS          1500000000LL
+#define STEP_AT_NS      200000000LL
+#define CTRL_NS         5000000LL       // PI period
+#define PLANT_DT_NS     2000LL          // plant step in virtual time
+
+// ====== PI speed loop ======
+struct pi {
+    double kp, ki;          // duty % per rpm, duty % per rpm s
+    double integ;           // duty %
+    int duty;
+};
+
+static int pi_update(struct pi *pi, double setpoint, double rpm, double dt_s)
+{
+    double e = setpoint - rpm;
+    double out = pi->kp * e + pi->integ + pi->ki * e * dt_s;
+
+    // integrate only while the output is not pinned (anti-windup)
+    if ((out < 100.0 || e < 0) && (out > 0.0 || e > 0))
+        pi->integ += pi->ki * e * dt_s;
+    pi->duty = (int)lround(clamp(pi->kp * e + pi->integ, 0.0, 100.0));
+    return pi->duty;
+}
+
+// rpm from the tach period, decaying to 0 once edges stop coming
+static double tach_rpm(u64 period_ns, s64 since_edge_ns, int ppr)
+{
+    double period_s = period_ns * 1e-9;
+
+    if (!period_ns)
+        return 0.0;
+    if (since_edge_ns * 1e-9 > period_s)
+        period_s = since_edge_ns * 1e-9;
+    return period_s > 0.5 ? 0.0 : 60.0 / (period_s * ppr);
+}
+
+// ====== Step response summary ======
+struct resp {
+    FILE *csv;
+    double setpoint;
+    double t_10, t_90, t_settle;    // s after the step, -1 = not reached
+    double peak;
+    double sum_err;                 // over the last 0.3 s
+    int n_err;
+};
+
+static void resp_log(struct resp *r, s64 t_ns, double sp, double rpm, double meas, int duty)
+{
+    double t = (t_ns - STEP_AT_NS) * 1e-9;
+
+    if (r->csv)
+        fprintf(r->csv, "%.3f,%.0f,%.1f,%.1f,%d\n", t_ns * 1e-6, sp, rpm, meas, duty);
+    if (t < 0)
+        return;
+    if (r->t_10 < 0 && rpm >= 0.1 * r->setpoint)
+        r->t_10 = t;
+    if (r->t_90 < 0 && rpm >= 0.9 * r->setpoint)
+        r->t_90 = t;
+    if (fabs(rpm - r->setpoint) > 0.02 * r->setpoint)
+        r->t_settle = -1;
+    else if (r->t_settle < 0)
+        r->t_settle = t;
+    if (rpm > r->peak)
+        r->peak = rpm;
+    if (t_ns > RUN_NS - 300000000LL) {
+        r->sum_err += rpm - r->setpoint;
+        r->n_err++;
+    }
+}
+
+static void resp_print(const struct resp *r)
+{
+    printf("step 0 -> %.0f rpm\n", r->setpoint);
+    printf("  rise 10-90%%   %.1f ms\n", (r->t_90 - r->t_10) * 1e3);
+    printf("  overshoot     %.1f %%\n", 100.0 * (r->peak - r->setpoint) / r->setpoint);
+    printf("  settle 2%%     %.1f ms\n", r->t_settle < 0 ? -1.0 : r->t_settle * 1e3);
+    printf("  steady error  %.1f rpm\n", r->n_err ? r->sum_err / r->n_err : 0.0);
+}
+
+// ====== Virtual time: core + plant under kshim ======
+static struct myrt_core core;
+static struct plant motor;
+static struct pi pi = { .kp = 0.02, .ki = 0.4 };
+static struct resp resp = { .t_10 = -1, .t_90 = -1, .t_settle = -1 };
+static struct hrtimer plant_timer, ctrl_timer;
+
+static enum hrtimer_restart plant_timer_callback(struct hrtimer *timer)
+{
+    struct gpio_desc *in = core.meas_gpios->desc[0];
+    int tach = plant_step(&motor, core.pwm_gpios->desc[0]->value, PLANT_DT_NS * 1e-9);
+
+    if (tach != in->value)
+        kshim_gpio_set_input(in, tach);
+    hrtimer_add_expires_ns(timer, PLANT_DT_NS);
+    return HRTIMER_RESTART;
+}
+
+static enum hrtimer_restart ctrl_timer_callback(struct hrtimer *timer)
+{
+    s64 now = ktime_get();
+    double sp = now >= STEP_AT_NS ? resp.setpoint : 0.0;
+    struct capture_stats st;
+    double meas;
+
+    capture_snapshot(&core.caps[0], &st);
+    meas = tach_rpm(st.period_ns, now - st.last_edge, motor.p.ppr);
+
+    pwm_set_duty(&core, 0, pi_update(&pi, sp, meas, CTRL_NS * 1e-9));
+    resp_log(&resp, now, sp, plant_rpm(&motor), meas, pi.duty);
+    hrtimer_add_expires_ns(timer, CTRL_NS);
+    return HRTIMER_RESTART;
+}
+
+static int run_sim(s64 latency_ns)
+{
+    struct plant_params p;
+
+    plant_default_params(&p);
+    plant_init(&motor, &p);
+    core.pwm_gpios = kshim_gpio_descs_alloc(1, -1);
+    core.meas_gpios = kshim_gpio_descs_alloc(1, 0);
+    core.n_pwm = 1;
+    core.n_meas = 1;
+    myrt_core_init(&core);
+    pwm_set_duty(&core, 0, 0);
+    core.caps[0].irq = gpiod_to_irq(core.meas_gpios->desc[0]);
+    request_irq(core.caps[0].irq, gpio_irq_handler, IRQF_TRIGGER_RISING,
+                "myrt_gpio_irq", &core.caps[0]);
+
+    hrtimer_init(&plant_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    plant_timer.function = plant_timer_callback;
+    hrtimer_start(&plant_timer, PLANT_DT_NS / 2, HRTIMER_MODE_ABS);
+    hrtimer_init(&ctrl_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    ctrl_timer.function = ctrl_timer_callback;
+    hrtimer_start(&ctrl_timer, CTRL_NS, HRTIMER_MODE_ABS);
+    myrt_core_start(&core);
+
+    // every callback, the plant's included, runs latency_ns after its
+    // expiry; the plant still integrates in fixed PLANT_DT_NS steps
+    kshim_latency_ns = latency_ns;
+    kshim_run_until(RUN_NS);
+    printf("virtual run, wakeup latency %lld ns, PWM steps skipped %llu\n",
+           (long long)latency_ns, (unsigned long long)core.overruns);
+    return 0;
+}
+
+// ====== Real time: myrt on gpio-sim ======
+static s64 mono_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static int open_or_die(const char *fn, int flags)
+{
+    int fd = open(fn, flags);
+
+    if (fd < 0) {
+        perror(fn);
+        exit(2);
+    }
+    return fd;
+}
+
+static int run_gpio_sim(const char *dir, int pwm_line, int meas_line)
+{
+    char fn[256], buf[32];
+    int pwm_fd, pull_fd, dev_fd, edges_fd, period_fd;
+    s64 start, now, last, next_ctrl, last_edge_ns;
+    unsigned long long edges = 0, e;
+    u64 period_ns = 0;
+    struct plant_params p;
+    int tach = 0;
+
+    snprintf(fn, sizeof(fn), "%s/sim_gpio%d/value", dir, pwm_line);
+    pwm_fd = open_or_die(fn, O_RDONLY);
+    snprintf(fn, sizeof(fn), "%s/sim_gpio%d/pull", dir, meas_line);
+    pull_fd = open_or_die(fn, O_WRONLY);
+    dev_fd = open_or_die("/dev/myrt0", O_RDWR);
+    edges_fd = open_or_die("/sys/class/myrtclass/myrt0/capture_edges", O_RDONLY);
+    period_fd = open_or_die("/sys/class/myrtclass/myrt0/period_ns", O_RDONLY);
+
+    plant_default_params(&p);
+    plant_init(&motor, &p);
+    pwrite(pull_fd, "pull-down", 9, 0);
+    write(dev_fd, "0\n", 2);
+
+    start = last = mono_ns();
+    next_ctrl = start + CTRL_NS;
+    last_edge_ns = start;
+    while ((now = mono_ns()) - start < RUN_NS) {
+        char c = '0';
+        ssize_t n;
+
+        // the plant integrates whatever the PWM line held since the last poll
+        pread(pwm_fd, &c, 1, 0);
+        if (plant_step(&motor, c == '1', (now - last) * 1e-9) != tach) {
+            tach = motor.tach;
+            if (tach)
+                pwrite(pull_fd, "pull-up", 7, 0);
+            else
+                pwrite(pull_fd, "pull-down", 9, 0);
+        }
+        last = now;
+        if (now < next_ctrl)
+            continue;
+
+        // myrt's view of the tach: period and edge count from sysfs
+        n = pread(edges_fd, buf, sizeof(buf) - 1, 0);
+        buf[n > 0 ? n : 0] = '\0';
+        e = strtoull(buf, NULL, 10);
+        if (e != edges) {
+            edges = e;
+            last_edge_ns = now;
+            n = pread(period_fd, buf, sizeof(buf) - 1, 0);
+            buf[n > 0 ? n : 0] = '\0';
+            period_ns = strtoull(buf, NULL, 10);
+        }
+        {
+            s64 t = now - start;
+            double sp = t >= STEP_AT_NS ? resp.setpoint : 0.0;
+            double meas = tach_rpm(period_ns, now - last_edge_ns, p.ppr);
+
+            pi_update(&pi, sp, meas, CTRL_NS * 1e-9);
+            n = snprintf(buf, sizeof(buf), "%d\n", pi.duty);
+            write(dev_fd, buf, n);
+            resp_log(&resp, t, sp, plant_rpm(&motor), meas, pi.duty);
+        }
+        next_ctrl += CTRL_NS;
+    }
+    write(dev_fd, "0\n", 2);
+    pwrite(pull_fd, "pull-down", 9, 0);
+    printf("real-time run on %s\n", dir);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *csv = NULL;
+    int ret;
+
+    if (argc > 1 && !strcmp(argv[1], "sim")) {
+        resp.setpoint = argc > 2 ? atof(argv[2]) : 3000;
+        csv = argc > 4 ? argv[4] : NULL;
+        if (csv && !(resp.csv = fopen(csv, "w"))) {
+            perror(csv);
+            return 2;
+        }
+        if (resp.csv)
+            fprintf(resp.csv, "t_ms,setpoint_rpm,speed_rpm,measured_rpm,duty\n");
+        ret = run_sim(argc > 3 ? atoll(argv[3]) : 0);
+    } else if (argc > 4 && !strcmp(argv[1], "gpio-sim")) {
+        resp.setpoint = argc > 5 ? atof(argv[5]) : 3000;
+        csv = argc > 6 ? argv[6] : NULL;
+        if (csv && !(resp.csv = fopen(csv, "w"))) {
+            perror(csv);
+            return 2;
+        }
+        if (resp.csv)
+            fprintf(resp.csv, "t_ms,setpoint_rpm,speed_rpm,measured_rpm,duty\n");
+        ret = run_gpio_sim(argv[2], atoi(argv[3]), atoi(argv[4]));
+    } else {
+        fprintf(stderr, "Usage: %s sim [rpm] [latency_ns] [out.csv]\n"
+                        "       %s gpio-sim <sim_chip_dir> <pwm_line> <meas_line> [rpm] [out.csv]\n",
+                argv[0], argv[0]);
+        return 2;
+    }
+    resp_print(&resp);
+    if (resp.csv)
+        fclose(resp.csv);
+    return ret;
+}
@@ -0,0 +1,293 @@
+// myrt_test.c
+// Checks of the myrt core against kshim in virtual time: the results are
+// the same on every machine, so they are compared exactly or against tight
+// bounds. Prints every failed check and exits non-zero if there was one.
+// Build and run: make test
+
+#include "kshim.h"
+#include "myrt_core.h"
+
+#define N_PWM   4
+#define N_MEAS  2
+
+static struct myrt_core core;
+static struct hrtimer ref_timer, probe_timer, step_timer;
+static s64 ref_period_ns;
+static int failed;
+
+#define CHECK(cond, fmt, ...) do {                                          \
+    if (!(cond)) {                                                          \
+        printf("FAIL %s: %s (" fmt ")\n", __func__, #cond, ##__VA_ARGS__);  \
+        failed++;                                                           \
+    }                                                                       \
+} while (0)
+
+// reference signal on MEAS_IN 0: 10 us high pulse every ref_period_ns
+static enum hrtimer_restart ref_timer_callback(struct hrtimer *timer)
+{
+    struct gpio_desc *in = core.meas_gpios->desc[0];
+
+    if (!in->value) {
+        kshim_gpio_set_input(in, 1);
+        hrtimer_add_expires_ns(timer, 10000);
+    } else {
+        kshim_gpio_set_input(in, 0);
+        hrtimer_add_expires_ns(timer, ref_period_ns - 10000);
+    }
+    return HRTIMER_RESTART;
+}
+
+static void setup(void)
+{
+    unsigned int ch;
+
+    kshim_reset();
+    memset(&core, 0, sizeof(core));
+    core.pwm_gpios = kshim_gpio_descs_alloc(N_PWM, -1);
+    core.meas_gpios = kshim_gpio_descs_alloc(N_MEAS, 0);
+    core.n_pwm = N_PWM;
+    core.n_meas = N_MEAS;
+    myrt_core_init(&core);
+    for (ch = 0; ch < N_PWM; ch++)
+        pwm_set_duty(&core, ch, 10 + 25 * ch);
+    for (ch = 0; ch < N_MEAS; ch++) {
+        core.caps[ch].irq = gpiod_to_irq(core.meas_gpios->desc[ch]);
+        if (request_irq(core.caps[ch].irq, gpio_irq_handler, IRQF_TRIGGER_RISING,
+                        "myrt_gpio_irq", &core.caps[ch])) {
+            fprintf(stderr, "request_irq %d failed\n", ch);
+            exit(1);
+        }
+    }
+    core.pll.kp_shift = 1;
+    core.pll.ki_shift = 4;
+    core.pll.lock_ns = 5000;
+}
+
+static void teardown(void)
+{
+    myrt_core_stop(&core);
+    kshim_gpio_descs_free(core.pwm_gpios);
+    kshim_gpio_descs_free(core.meas_gpios);
+}
+
+// ====== PLL on the capture input ======
+// 2 s against a reference 300 ns per period slow, starting a quarter
+// period off: the I part ends up at the offset, the phase at 0
+static void run_pll(s64 latency_ns)
+{
+    setup();
+    pll_set_enabled(&core, true);
+    ref_period_ns = PWM_PERIOD_NS + 300;
+    hrtimer_init(&ref_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    ref_timer.function = ref_timer_callback;
+    hrtimer_start(&ref_timer, 250000, HRTIMER_MODE_ABS);
+    myrt_core_start(&core);
+    kshim_latency_ns = latency_ns;
+    kshim_run_until(2 * NSEC_PER_SEC);
+    hrtimer_cancel(&ref_timer);
+}
+
+static void test_pll_lock(void)
+{
+    struct capture_stats st;
+
+    run_pll(0);
+    capture_snapshot(&core.caps[0], &st);
+    CHECK(core.pll.locked, "");
+    CHECK(abs((int)core.pll.phase_err_ns) <= 100, "%lld ns",
+          (long long)core.pll.phase_err_ns);
+    CHECK(core.pll.i_corr_ns == 300, "%lld ns", (long long)core.pll.i_corr_ns);
+    CHECK(st.period_ns == 1000300, "%llu", (unsigned long long)st.period_ns);
+    CHECK(st.edges == 2000, "%llu", (unsigned long long)st.edges);
+    CHECK(st.rejected == 0, "%llu", (unsigned long long)st.rejected);
+    CHECK(core.overruns == 0, "%llu", (unsigned long long)core.overruns);
+    teardown();
+}
+
+// every wakeup 15 us late, more than a step: steps are skipped, but the
+// period keeps its length, so the loop locks to the same offset
+static void test_pll_late_wakeups(void)
+{
+    struct capture_stats st;
+
+    run_pll(15000);
+    capture_snapshot(&core.caps[0], &st);
+    CHECK(core.overruns > 0, "");
+    CHECK(core.pll.locked, "");
+    CHECK(abs((int)core.pll.phase_err_ns) <= 100, "%lld ns",
+          (long long)core.pll.phase_err_ns);
+    CHECK(core.pll.i_corr_ns == 300, "%lld ns", (long long)core.pll.i_corr_ns);
+    CHECK(st.period_ns == 1000300, "%llu", (unsigned long long)st.period_ns);
+    CHECK(st.edges == 2000, "%llu", (unsigned long long)st.edges);
+    teardown();
+}
+
+// ====== PWM duty ======
+// the outputs sampled every 1 us over 10 periods
+static u64 high_us[N_PWM];
+
+static enum hrtimer_restart probe_timer_callback(struct hrtimer *timer)
+{
+    unsigned int ch;
+
+    for (ch = 0; ch < N_PWM; ch++)
+        high_us[ch] += core.pwm_gpios->desc[ch]->value;
+    hrtimer_add_expires_ns(timer, 1000);
+    return HRTIMER_RESTART;
+}
+
+static void test_pwm_duty(void)
+{
+    unsigned int ch;
+
+    setup();
+    memset(high_us, 0, sizeof(high_us));
+    hrtimer_init(&probe_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    probe_timer.function = probe_timer_callback;
+    myrt_core_start(&core);
+    // from the first period start on, half a microsecond off the steps
+    hrtimer_start(&probe_timer, PWM_STEP_NS + 500, HRTIMER_MODE_ABS);
+    kshim_run_until(PWM_STEP_NS + 10 * PWM_PERIOD_NS);
+    for (ch = 0; ch < N_PWM; ch++)
+        CHECK(high_us[ch] == (10 + 25 * ch) * 100, "ch %u: %llu us high of 10000",
+              ch, (unsigned long long)high_us[ch]);
+    hrtimer_cancel(&probe_timer);
+    teardown();
+}
+
+// ====== Alignment to a clock ======
+// offset, 20000 ppb fast and stepped halfway: one jump to get on the
+// grid, one after the step, and locked onto the multiples at the end
+static s64 ref_offs_ns;
+
+static ktime_t ref_clock(struct myrt_core *c, ktime_t mono)
+{
+    return mono + ref_offs_ns + mono / 1000 * 20000 / 1000000;
+}
+
+static enum hrtimer_restart step_timer_callback(struct hrtimer *timer)
+{
+    ref_offs_ns += 123456;
+    return HRTIMER_NORESTART;
+}
+
+static void test_align_clock(void)
+{
+    s32 phase;
+
+    setup();
+    core.pll_ref_clock = ref_clock;
+    ref_offs_ns = 37000000123LL;
+    pll_align_clock(&core, 0);
+    hrtimer_init(&step_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    step_timer.function = step_timer_callback;
+    hrtimer_start(&step_timer, NSEC_PER_SEC, HRTIMER_MODE_ABS);
+    myrt_core_start(&core);
+    kshim_run_until(2 * NSEC_PER_SEC);
+
+    div_s64_rem(ktime_to_ns(ref_clock(&core, core.period_start)), core.period_ns,
+                &phase);
+    CHECK(core.pll.locked, "");
+    CHECK(core.pll.jumps == 2, "%llu", (unsigned long long)core.pll.jumps);
+    CHECK(abs(phase) <= 100, "%d ns past a multiple", phase);
+    CHECK(core.pll.phase_err_max_ns <= 1000, "%lld ns",
+          (long long)core.pll.phase_err_max_ns);
+    CHECK(core.pll.i_corr_ns == -20, "%lld ns", (long long)core.pll.i_corr_ns);
+    hrtimer_cancel(&step_timer);
+    core.pll_ref_clock = NULL;
+    pll_set_enabled(&core, false);
+    teardown();
+}
+
+// ====== Deferred resample ======
+// A 10 us pulse, resampled 8 us after its edge, with the drain 5 us late:
+// the level is read 8 us after the edge (still high), not 8 us after the
+// drain (low again), and the edge is accepted by the drain, not the timer
+static int kicks;
+
+static void kick_count(struct myrt_core *c)
+{
+    kicks++;
+}
+
+static void test_deferred_resample(void)
+{
+    struct capture_chan *cap;
+    struct gpio_desc *in;
+    struct capture_stats st;
+
+    setup();
+    cap = &core.caps[1];
+    in = core.meas_gpios->desc[1];
+    core.capture_kick = kick_count;
+    kicks = 0;
+    capture_set_deglitch(cap, 0, 8000);
+
+    kshim_now = 1000;
+    kshim_gpio_set_input(in, 1);
+    CHECK(kicks == 1, "%d", kicks);
+    kshim_now = 6000;
+    capture_drain(&core);
+    kshim_run_until(10000);
+    CHECK(kicks == 2, "%d", kicks);
+    capture_snapshot(cap, &st);
+    CHECK(st.edges == 0, "%llu accepted in the timer", (unsigned long long)st.edges);
+    kshim_now = 11000;
+    kshim_gpio_set_input(in, 0);
+    capture_drain(&core);
+    capture_snapshot(cap, &st);
+    CHECK(st.edges == 1, "%llu", (unsigned long long)st.edges);
+    CHECK(st.rejected == 0, "%llu", (unsigned long long)st.rejected);
+    CHECK(st.last_edge == 1000, "%lld", (long long)st.last_edge);
+    CHECK(!cap->resample_busy, "");
+    core.capture_kick = NULL;
+    teardown();
+}
+
+// ====== PWM lines that can sleep ======
+// with pwm_kick set the timer leaves the lines alone and only kicks; the
+// writer puts the last levels on them, all low after an e-stop
+static int pwm_kicks;
+
+static void pwm_kick_count(struct myrt_core *c)
+{
+    pwm_kicks++;
+}
+
+static void test_pwm_kick(void)
+{
+    u64 writes;
+
+    setup();
+    core.pwm_kick = pwm_kick_count;
+    pwm_kicks = 0;
+    writes = kshim_stats.array_writes;
+    myrt_core_start(&core);
+    kshim_run_until(PWM_STEP_NS + PWM_PERIOD_NS / 2);
+    // all four channels switch on at step 0, one off at steps 10 and 35
+    CHECK(pwm_kicks == 3, "%d", pwm_kicks);
+    CHECK(kshim_stats.array_writes == writes, "");
+    CHECK(core.pwm_state == 0xc, "%lx", core.pwm_state);
+    CHECK(core.pwm_gpios->desc[3]->value == 0, "");
+    pwm_write_levels(&core);
+    CHECK(core.pwm_gpios->desc[3]->value == 1, "");
+    CHECK(core.pwm_gpios->desc[0]->value == 0, "");
+    pwm_estop(&core, ktime_get());
+    CHECK(pwm_kicks == 4, "%d", pwm_kicks);
+    pwm_write_levels(&core);
+    CHECK(core.pwm_gpios->desc[3]->value == 0, "");
+    core.pwm_kick = NULL;
+    teardown();
+}
+
+int main(void)
+{
+    test_pll_lock();
+    test_pll_late_wakeups();
+    test_pwm_duty();
+    test_align_clock();
+    test_deferred_resample();
+    test_pwm_kick();
+    printf("%s\n", failed ? "FAILED" : "all passed");
+    return failed ? 1 : 0;
+}
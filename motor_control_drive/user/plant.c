@@ -0,0 +1,63 @@
+// plant.c
+// See plant.h. Semi-implicit Euler on
+//   J dw/dt = k i - b w - tc sgn(w) - load,  i = (u - k w) / R
+// where u is the supply while the PWM output is high and 0 otherwise.
+
+#include <math.h>
+
+#include "plant.h"
+
+void plant_default_params(struct plant_params *p)
+{
+    // small 12 V brushed motor: ~5700 rpm no load, 0.1 s mechanical tau
+    p->supply_v = 12.0;
+    p->r_ohm = 2.0;
+    p->k = 0.02;
+    p->j = 2e-5;
+    p->b = 1e-6;
+    p->tc = 1e-3;
+    p->load = 0.0;
+    p->ppr = 12;
+}
+
+void plant_init(struct plant *pl, const struct plant_params *p)
+{
+    pl->p = *p;
+    pl->w = 0.0;
+    pl->angle = 0.0;
+    pl->tach = 0;
+}
+
+int plant_step(struct plant *pl, int pwm, double dt_s)
+{
+    const struct plant_params *p = &pl->p;
+    double u = pwm ? p->supply_v : 0.0;
+    double drive = p->k * (u - p->k * pl->w) / p->r_ohm - p->load;
+    double slot = 2.0 * M_PI / p->ppr;
+    double torque;
+
+    // stiction: stay put until the drive beats Coulomb friction
+    if (pl->w == 0.0 && fabs(drive) <= p->tc) {
+        torque = 0.0;
+    } else {
+        double sgn = pl->w != 0.0 ? copysign(1.0, pl->w) : copysign(1.0, drive);
+
+        torque = drive - p->b * pl->w - p->tc * sgn;
+    }
+    {
+        double w = pl->w + torque / p->j * dt_s;
+
+        // friction alone never reverses the motor
+        if (pl->w != 0.0 && w * pl->w < 0.0 && fabs(drive) <= p->tc)
+            w = 0.0;
+        pl->w = w;
+    }
+    pl->angle += pl->w * dt_s;
+    pl->tach = fmod(fabs(pl->angle), slot) >= slot / 2;
+    return pl->tach;
+}
+
+double plant_rpm(const struct plant *pl)
+{
+    return pl->w * 60.0 / (2.0 * M_PI);
+}
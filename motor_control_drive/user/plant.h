@@ -0,0 +1,34 @@
+// plant.h
+// First-order DC motor driven by a PWM'd supply, with a tach that gives
+// ppr pulses per revolution. Plain C, no kernel or kshim types, so the
+// same model runs in virtual time next to the core and in real time next
+// to gpio-sim.
+#ifndef PLANT_H
+#define PLANT_H
+
+struct plant_params {
+    double supply_v;
+    double r_ohm;           // winding resistance, inductance neglected
+    double k;               // torque constant = back-EMF constant, Nm/A
+    double j;               // rotor + load inertia, kg m^2
+    double b;               // viscous friction, Nm s
+    double tc;              // Coulomb friction, Nm
+    double load;            // constant load torque, Nm
+    int ppr;                // tach pulses per revolution, 50 % high
+};
+
+struct plant {
+    struct plant_params p;
+    double w;               // rad/s
+    double angle;           // rad, since start
+    int tach;               // current tach level
+};
+
+void plant_default_params(struct plant_params *p);
+void plant_init(struct plant *pl, const struct plant_params *p);
+// Advance by dt_s with the bridge on (pwm = 1) or freewheeling into the
+// supply short (pwm = 0). Returns the new tach level.
+int plant_step(struct plant *pl, int pwm, double dt_s);
+double plant_rpm(const struct plant *pl);
+
+#endif